@@ -0,0 +1,145 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * DiscBitmap.cpp
+ * Implementation for the DiscBitmap class.
+ */
+
+#include "bitmap.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Checks a single discriminator.
+ * @param disc discriminator to look up, may be out of range
+ * @return true if the bit for disc is set
+ */
+bool DiscBitmap::test(int disc) const {
+    if (disc < MIN_DISC || disc > MAX_DISC)
+        return false;
+    return (_words[(disc - MIN_DISC) >> 6] >> ((disc - MIN_DISC) & 63)) & 1;
+}
+
+/**
+ * Counts the set bits, a whole vector of words at a time.
+ * @return number of discriminators in use
+ */
+int DiscBitmap::count() const {
+#if defined(__AVX2__)
+    const __m256i m1 = _mm256_set1_epi8(0x55);
+    const __m256i m2 = _mm256_set1_epi8(0x33);
+    const __m256i m4 = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+
+    for (int w = 0; w < BITMAP_WORDS; w += 4) {
+        __m256i v = _mm256_load_si256((const __m256i*)(_words + w));
+        v = _mm256_sub_epi8(v, _mm256_and_si256(_mm256_srli_epi16(v, 1), m1));
+        v = _mm256_add_epi8(_mm256_and_si256(v, m2), _mm256_and_si256(_mm256_srli_epi16(v, 2), m2));
+        v = _mm256_and_si256(_mm256_add_epi8(v, _mm256_srli_epi16(v, 4)), m4);
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(v, _mm256_setzero_si256()));
+    }
+
+    return _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+           _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+#elif defined(__SSE2__)
+    //per byte bit counts, then summed across each half with sad
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0f);
+    __m128i total = _mm_setzero_si128();
+
+    for (int w = 0; w < BITMAP_WORDS; w += 2) {
+        __m128i v = _mm_load_si128((const __m128i*)(_words + w));
+        v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+        v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi16(v, 2), m2));
+        v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+        total = _mm_add_epi64(total, _mm_sad_epu8(v, _mm_setzero_si128()));
+    }
+
+    return _mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total));
+#else
+    int total = 0;
+    for (int w = 0; w < BITMAP_WORDS; w++)
+        total += __builtin_popcountll(_words[w]);
+    return total;
+#endif
+}
+
+/**
+ * Finds the smallest discriminator whose bit is clear, skipping full
+ * vectors with a single compare.
+ * @return lowest unused discriminator, INVALID_DISC if all are taken
+ */
+int DiscBitmap::firstFree() const {
+    int w = 0;
+
+#if defined(__AVX2__)
+    const __m256i full = _mm256_set1_epi32(-1);
+    for (; w < BITMAP_WORDS; w += 4) {
+        __m256i v = _mm256_load_si256((const __m256i*)(_words + w));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, full)) != -1)
+            break;
+    }
+#elif defined(__SSE2__)
+    const __m128i full = _mm_set1_epi32(-1);
+    for (; w < BITMAP_WORDS; w += 2) {
+        __m128i v = _mm_load_si128((const __m128i*)(_words + w));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, full)) != 0xffff)
+            break;
+    }
+#endif
+
+    //the vector that stopped the scan has a clear bit in one of its words
+    for (; w < BITMAP_WORDS; w++) {
+        if (~_words[w]) {
+            int disc = MIN_DISC + w * 64 + __builtin_ctzll(~_words[w]);
+            return disc <= MAX_DISC ? disc : INVALID_DISC;
+        }
+    }
+    return INVALID_DISC;
+}
+
+/**
+ * Checks a batch of discriminators at once.
+ * @param discs discriminators to look up, may be out of range
+ * @param n number of discriminators
+ * @param found set to whether each disc is in use, in the same order
+ * @return number of discs found
+ */
+int DiscBitmap::contains(const int discs[], int n, bool found[]) const {
+    int numFound = 0;
+    int i = 0;
+
+#if defined(__AVX2__)
+    //gather the 32-bit word holding each disc, eight discs per step
+    const int* words = (const int*)_words;
+    const __m256i lo = _mm256_set1_epi32(MIN_DISC - 1);
+    const __m256i hi = _mm256_set1_epi32(MAX_DISC + 1);
+    const __m256i one = _mm256_set1_epi32(1);
+    int bits[8];
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i disc = _mm256_loadu_si256((const __m256i*)(discs + i));
+        __m256i inRange = _mm256_and_si256(_mm256_cmpgt_epi32(disc, lo), _mm256_cmpgt_epi32(hi, disc));
+        __m256i index = _mm256_and_si256(_mm256_sub_epi32(disc, _mm256_set1_epi32(MIN_DISC)), inRange);
+
+        __m256i word = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words,
+                                                   _mm256_srli_epi32(index, 5), inRange, 4);
+        __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(index, _mm256_set1_epi32(31))), one);
+        _mm256_storeu_si256((__m256i*)bits, _mm256_and_si256(bit, inRange));
+
+        for (int j = 0; j < 8; j++) {
+            found[i + j] = bits[j];
+            numFound += bits[j];
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        found[i] = test(discs[i]);
+        numFound += found[i];
+    }
+    return numFound;
+}
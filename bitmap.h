@@ -0,0 +1,39 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * DiscBitmap.h
+ * An occupancy bitmap over every possible discriminator.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "disc.h"
+
+#define BITMAP_WORDS 160    /* 10240 bits, a whole number of 256-bit blocks */
+
+static_assert(BITMAP_WORDS * 64 >= NUM_DISC, "bitmap too small for the discriminator range");
+
+/**
+ * One bit per discriminator, set while a valid account holds it. The bits
+ * past MAX_DISC are padding and always stay clear. count(), firstFree() and
+ * contains() use SSE2, or AVX2 when built with it, and fall back to plain
+ * word loops elsewhere.
+ */
+class DiscBitmap {
+public:
+    DiscBitmap() {clear();}
+
+    bool test(int disc) const;
+    void set(int disc) {_words[(disc - MIN_DISC) >> 6] |= (uint64_t(1) << ((disc - MIN_DISC) & 63));}
+    void reset(int disc) {_words[(disc - MIN_DISC) >> 6] &= ~(uint64_t(1) << ((disc - MIN_DISC) & 63));}
+    void clear() {memset(_words, 0, sizeof(_words));}
+
+    int count() const;
+    int firstFree() const;
+    int contains(const int discs[], int n, bool found[]) const;
+
+private:
+    alignas(32) uint64_t _words[BITMAP_WORDS];
+};
@@ -0,0 +1,373 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * DiscriminatorBTree.cpp
+ * Implementation for the DBTree class.
+ */
+
+#include "btree.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Destructor, deletes all dynamic memory.
+ */
+DBTree::~DBTree() {
+    clear();
+}
+
+/**
+ * Inserts an account, splitting full nodes on the way down so the leaf
+ * always has room. Ends the life of the DNode last handed out by remove().
+ * @param newAcct Account object to move into the tree
+ * @return true if the account was inserted, false otherwise
+ */
+bool DBTree::insert(Account&& newAcct) {
+    releaseRemoved();
+    int disc = newAcct.getDiscriminator();
+    if (disc < MIN_DISC || disc > MAX_DISC)
+        return false;
+
+    if (!_root)
+        _root = _nodes.allocate(true);
+
+    //a full root splits under a new root, the only way the tree grows taller
+    if (_root->_count == BNODE_KEYS) {
+        BNode* root = _nodes.allocate(false);
+        root->_children[0] = _root;
+        _root = root;
+        splitChild(root, 0);
+    }
+
+    BNode* node = _root;
+    while (!node->_leaf) {
+        int i = countLess(node->_keys, disc + 1);
+        if (node->_children[i]->_count == BNODE_KEYS) {
+            splitChild(node, i);
+            if (disc >= node->_keys[i])
+                i++;
+        }
+        node = node->_children[i];
+    }
+
+    int pos = countLess(node->_keys, disc);
+    if (pos < node->_count && node->_keys[pos] == disc)
+        return false;
+
+    for (int j = node->_count; j > pos; j--) {
+        node->_keys[j] = node->_keys[j - 1];
+        node->_dnodes[j] = node->_dnodes[j - 1];
+    }
+    node->_keys[pos] = disc;
+    node->_dnodes[pos] = _pool.allocate(std::move(newAcct));
+    node->_count++;
+
+    _numUsers++;
+    return true;
+}
+
+/**
+ * Removes an account, merging or refilling nodes that get too small.
+ * @param disc discriminator to match
+ * @param removed set to the removed DNode, valid until the next write
+ * @return true if an account was removed, false otherwise
+ */
+bool DBTree::remove(int disc, DNode*& removed) {
+    releaseRemoved();
+    if (!_root || disc < MIN_DISC || disc > MAX_DISC)
+        return false;
+
+    if (!removeHelper(_root, disc, removed))
+        return false;
+    _removed = removed;
+
+    //an empty root hands over to its only child, or the tree is empty
+    if (_root->_count == 0) {
+        BNode* root = _root;
+        _root = root->_leaf ? nullptr : root->_children[0];
+        _nodes.release(root);
+    }
+
+    _numUsers--;
+    return true;
+}
+
+/**
+ * Retrieves the DNode with a discriminator. Only the key arrays are read
+ * on the way down, the DNode itself on a hit.
+ * @param disc discriminator to search for
+ * @return DNode with a matching discriminator, nullptr otherwise
+ */
+DNode* DBTree::retrieve(int disc) const {
+    if (!_root || disc < MIN_DISC || disc > MAX_DISC)
+        return nullptr;
+
+    BNode* node = _root;
+    while (!node->_leaf)
+        node = node->_children[countLess(node->_keys, disc + 1)];
+
+    int pos = countLess(node->_keys, disc);
+    if (pos < node->_count && node->_keys[pos] == disc)
+        return node->_dnodes[pos];
+    return nullptr;
+}
+
+/**
+ * Deletes every node and account.
+ */
+void DBTree::clear() {
+    _nodes.clear();
+    _pool.clear();
+    _root = nullptr;
+    _numUsers = 0;
+    _removed = nullptr;
+}
+
+/**
+ * Prints all accounts' details, in discriminator order.
+ */
+void DBTree::printAccounts() const {
+    print(_root);
+}
+
+/**
+ * Returns the number of levels, every leaf sits at the same depth.
+ * @return height of the tree, 0 when empty
+ */
+int DBTree::getHeight() const {
+    int height = 0;
+    for (BNode* node = _root; node; node = node->_leaf ? nullptr : node->_children[0])
+        height++;
+    return height;
+}
+
+//number of keys in the node below disc, every slot is compared at once
+int DBTree::countLess(const int16_t keys[], int disc) {
+#if defined(__AVX2__)
+    const __m256i key = _mm256_set1_epi16(disc);
+    unsigned int lo = _mm256_movemask_epi8(_mm256_cmpgt_epi16(key, _mm256_load_si256((const __m256i*)keys)));
+    unsigned int hi = _mm256_movemask_epi8(_mm256_cmpgt_epi16(key, _mm256_load_si256((const __m256i*)(keys + 16))));
+
+    //two mask bits per 16-bit key
+    return (__builtin_popcount(lo) + __builtin_popcount(hi)) / 2;
+#elif defined(__SSE2__)
+    const __m128i key = _mm_set1_epi16(disc);
+    int less = 0;
+    for (int i = 0; i < BNODE_KEYS; i += 8)
+        less += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi16(key, _mm_load_si128((const __m128i*)(keys + i)))));
+    return less / 2;
+#else
+    int less = 0;
+    while (less < BNODE_KEYS && keys[less] < disc)
+        less++;
+    return less;
+#endif
+}
+
+//split the full child i of parent in two, moving a key up into parent
+void DBTree::splitChild(BNode* parent, int i) {
+    BNode* child = parent->_children[i];
+    BNode* right = _nodes.allocate(child->_leaf);
+    int separator;
+
+    if (child->_leaf) {
+        //leaves keep every key, the right half's first key is copied up
+        for (int j = BNODE_KEYS / 2; j < BNODE_KEYS; j++) {
+            right->_keys[j - BNODE_KEYS / 2] = child->_keys[j];
+            right->_dnodes[j - BNODE_KEYS / 2] = child->_dnodes[j];
+            child->_keys[j] = BNODE_PAD;
+        }
+        right->_count = BNODE_KEYS - BNODE_KEYS / 2;
+        separator = right->_keys[0];
+    }
+    else {
+        //the middle key moves up, the keys after it go right
+        int middle = BNODE_KEYS / 2;
+        separator = child->_keys[middle];
+        for (int j = middle + 1; j < BNODE_KEYS; j++) {
+            right->_keys[j - middle - 1] = child->_keys[j];
+            right->_children[j - middle - 1] = child->_children[j];
+            child->_keys[j] = BNODE_PAD;
+        }
+        right->_children[BNODE_KEYS - middle - 1] = child->_children[BNODE_KEYS];
+        child->_keys[middle] = BNODE_PAD;
+        right->_count = BNODE_KEYS - middle - 1;
+    }
+    child->_count = BNODE_KEYS / 2;
+
+    for (int j = parent->_count; j > i; j--) {
+        parent->_keys[j] = parent->_keys[j - 1];
+        parent->_children[j + 1] = parent->_children[j];
+    }
+    parent->_keys[i] = separator;
+    parent->_children[i + 1] = right;
+    parent->_count++;
+}
+
+//remove disc below node, fixing up any child left with too few keys
+bool DBTree::removeHelper(BNode* node, int disc, DNode*& removed) {
+    if (node->_leaf) {
+        int pos = countLess(node->_keys, disc);
+        if (pos == node->_count || node->_keys[pos] != disc)
+            return false;
+
+        removed = node->_dnodes[pos];
+        for (int j = pos + 1; j < node->_count; j++) {
+            node->_keys[j - 1] = node->_keys[j];
+            node->_dnodes[j - 1] = node->_dnodes[j];
+        }
+        node->_count--;
+        node->_keys[node->_count] = BNODE_PAD;
+        return true;
+    }
+
+    //separators may name removed keys, they only have to route correctly
+    int i = countLess(node->_keys, disc + 1);
+    if (!removeHelper(node->_children[i], disc, removed))
+        return false;
+
+    if (node->_children[i]->_count < BNODE_MIN)
+        fixChild(node, i);
+    return true;
+}
+
+//free the DNode the last remove() handed out
+void DBTree::releaseRemoved() {
+    _pool.release(_removed);
+    _removed = nullptr;
+}
+
+//refill child i of parent from a sibling with keys to spare, or merge it into one
+void DBTree::fixChild(BNode* parent, int i) {
+    BNode* child = parent->_children[i];
+    BNode* left = i > 0 ? parent->_children[i - 1] : nullptr;
+    BNode* right = i < parent->_count ? parent->_children[i + 1] : nullptr;
+
+    if (left && left->_count > BNODE_MIN) {
+        //take the left sibling's last entry
+        for (int j = child->_count; j > 0; j--)
+            child->_keys[j] = child->_keys[j - 1];
+
+        if (child->_leaf) {
+            for (int j = child->_count; j > 0; j--)
+                child->_dnodes[j] = child->_dnodes[j - 1];
+            child->_keys[0] = left->_keys[left->_count - 1];
+            child->_dnodes[0] = left->_dnodes[left->_count - 1];
+            parent->_keys[i - 1] = child->_keys[0];
+        }
+        else {
+            for (int j = child->_count + 1; j > 0; j--)
+                child->_children[j] = child->_children[j - 1];
+            child->_keys[0] = parent->_keys[i - 1];
+            child->_children[0] = left->_children[left->_count];
+            parent->_keys[i - 1] = left->_keys[left->_count - 1];
+        }
+
+        left->_count--;
+        left->_keys[left->_count] = BNODE_PAD;
+        child->_count++;
+    }
+    else if (right && right->_count > BNODE_MIN) {
+        //take the right sibling's first entry
+        if (child->_leaf) {
+            child->_keys[child->_count] = right->_keys[0];
+            child->_dnodes[child->_count] = right->_dnodes[0];
+            for (int j = 1; j < right->_count; j++) {
+                right->_keys[j - 1] = right->_keys[j];
+                right->_dnodes[j - 1] = right->_dnodes[j];
+            }
+            parent->_keys[i] = right->_keys[0];
+        }
+        else {
+            child->_keys[child->_count] = parent->_keys[i];
+            child->_children[child->_count + 1] = right->_children[0];
+            parent->_keys[i] = right->_keys[0];
+            for (int j = 1; j < right->_count; j++)
+                right->_keys[j - 1] = right->_keys[j];
+            for (int j = 1; j <= right->_count; j++)
+                right->_children[j - 1] = right->_children[j];
+        }
+
+        right->_count--;
+        right->_keys[right->_count] = BNODE_PAD;
+        child->_count++;
+    }
+    else if (left) {
+        mergeChildren(parent, i - 1);
+    }
+    else {
+        mergeChildren(parent, i);
+    }
+}
+
+//fold child i + 1 of parent into child i, both are at or below the minimum
+void DBTree::mergeChildren(BNode* parent, int i) {
+    BNode* left = parent->_children[i];
+    BNode* right = parent->_children[i + 1];
+
+    if (left->_leaf) {
+        for (int j = 0; j < right->_count; j++) {
+            left->_keys[left->_count + j] = right->_keys[j];
+            left->_dnodes[left->_count + j] = right->_dnodes[j];
+        }
+        left->_count += right->_count;
+    }
+    else {
+        //the separator comes down between the two halves
+        left->_keys[left->_count] = parent->_keys[i];
+        left->_count++;
+        for (int j = 0; j < right->_count; j++) {
+            left->_keys[left->_count + j] = right->_keys[j];
+            left->_children[left->_count + j] = right->_children[j];
+        }
+        left->_children[left->_count + right->_count] = right->_children[right->_count];
+        left->_count += right->_count;
+    }
+    _nodes.release(right);
+
+    for (int j = i + 1; j < parent->_count; j++) {
+        parent->_keys[j - 1] = parent->_keys[j];
+        parent->_children[j] = parent->_children[j + 1];
+    }
+    parent->_count--;
+    parent->_keys[parent->_count] = BNODE_PAD;
+}
+
+void DBTree::print(BNode* node) const {
+    if (!node)
+        return;
+
+    for (int i = 0; i < node->_count; i++) {
+        if (node->_leaf)
+            cout << node->_dnodes[i]->getAccount() << endl;
+        else
+            print(node->_children[i]);
+    }
+    if (!node->_leaf)
+        print(node->_children[node->_count]);
+}
+
+/**
+ * Dump the DBTree, leaves as [disc disc ...] and internal nodes as
+ * (child key child ... child).
+ */
+void DBTree::dump(BNode* node) const {
+    if (!node)
+        return;
+
+    cout << (node->_leaf ? "[" : "(");
+    for (int i = 0; i < node->_count; i++) {
+        if (node->_leaf) {
+            cout << (i > 0 ? " " : "") << node->_keys[i];
+        }
+        else {
+            dump(node->_children[i]);
+            cout << " " << node->_keys[i] << " ";
+        }
+    }
+    if (!node->_leaf)
+        dump(node->_children[node->_count]);
+    cout << (node->_leaf ? "]" : ")");
+}
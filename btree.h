@@ -0,0 +1,92 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * DiscriminatorBTree.h
+ * An interface for the DBTree class, a high-fanout alternative to DTree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "dtree.h"
+
+#define BNODE_KEYS 32       /* keys per node, two AVX2 or four SSE2 compares */
+#define BNODE_MIN 15        /* fewest keys a non-root node keeps, an internal split leaves 15 */
+#define BNODE_PAD INT16_MAX /* fills unused key slots, above every disc */
+
+/**
+ * A B+tree node. Keys are kept sorted and contiguous, unused slots hold
+ * BNODE_PAD so a search can compare all of them without looking at _count.
+ * Leaves point at their DNodes, internal nodes at their children; the
+ * i-th key of an internal node is a lower bound for child i + 1.
+ */
+struct BNode {
+    alignas(64) int16_t _keys[BNODE_KEYS];
+    int _count;
+    bool _leaf;
+    union {
+        DNode* _dnodes[BNODE_KEYS];
+        BNode* _children[BNODE_KEYS + 1];
+    };
+
+    BNode(bool leaf) {
+        for (int i = 0; i < BNODE_KEYS; i++)
+            _keys[i] = BNODE_PAD;
+        _count = 0;
+        _leaf = leaf;
+    }
+};
+
+/**
+ * Holds the accounts of one username like DTree, but in a B+tree with up to
+ * BNODE_KEYS discriminators per node. A search within a node is a single
+ * vector compare of all its keys (SSE2, or AVX2 when built with it), so a
+ * few thousand discriminators take 2-3 levels instead of a dozen.
+ *
+ * The interface matches DTree's, so either can sit behind the same code:
+ * accounts are handed out in DNodes from a DNodePool, and remove() hands
+ * back the removed DNode, which like DTree's stays valid until the next
+ * write. Removed entries leave the tree right away, there are no vacant
+ * entries.
+ */
+class DBTree {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    DBTree(): _root(nullptr), _numUsers(0), _removed(nullptr) {}
+    ~DBTree();
+
+    DBTree(const DBTree&) = delete;
+    DBTree& operator=(const DBTree&) = delete;
+
+    /* Basic operations */
+    bool insert(const Account& newAcct) {return insert(Account(newAcct));}
+    bool insert(Account&& newAcct);
+    bool remove(int disc, DNode*& removed);
+    DNode* retrieve(int disc) const;
+    void clear();
+    void printAccounts() const;
+    void dump() const {dump(_root);}
+
+    /* Getters */
+    int getNumUsers() const {return _numUsers;}
+    bool contains(int disc) const {return retrieve(disc) != nullptr;}
+    int getHeight() const;
+
+private:
+    BNode* _root;
+    int _numUsers;
+    NodePool<BNode> _nodes;
+    DNodePool _pool;        /* the DNodes and their accounts */
+    DNode* _removed;        /* handed out by the last remove(), released by the next write */
+
+    static int countLess(const int16_t keys[], int disc);
+    void splitChild(BNode* parent, int i);
+    bool removeHelper(BNode* node, int disc, DNode*& removed);
+    void releaseRemoved();
+    void fixChild(BNode* parent, int i);
+    void mergeChildren(BNode* parent, int i);
+    void print(BNode* node) const;
+    void dump(BNode* node) const;
+};
@@ -0,0 +1,13 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * Disc.h
+ * The discriminator range, shared by DTree, DBTree and DiscBitmap.
+ */
+
+#pragma once
+
+#define INVALID_DISC -1
+#define MIN_DISC 0000
+#define MAX_DISC 9999
+#define NUM_DISC (MAX_DISC - MIN_DISC + 1)
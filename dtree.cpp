@@ -6,12 +6,31 @@
  */
 
 #include "dtree.h"
+#include <algorithm>
 
 /**
  * Destructor, deletes all dynamic memory.
  */
 DTree::~DTree() {
     clear();
+    dropFrozen();
+    delete _occupancy;
+}
+
+/**
+ * Copy constructor, makes a deep copy of a DTree in the same node pool.
+ * @param rhs Source DTree to copy
+ */
+DTree::DTree(const DTree& rhs): DTree(rhs._pool) {
+    *this = rhs;
+}
+
+/**
+ * Move constructor, takes over the nodes of a DTree without copying them.
+ * @param rhs Source DTree, left empty
+ */
+DTree::DTree(DTree&& rhs): DTree(rhs._pool) {
+    *this = std::move(rhs);
 }
 
 /**
@@ -23,13 +42,49 @@ DTree& DTree::operator=(const DTree& rhs) {
     if (this != &rhs){
       //clear the lhs
         clear();
+        if (!rhs._root)
+            return *this;
+
 	//allocate new root
-        _root = new DNode(rhs._root->_account);
-        _root->copy(rhs._root);
+        _root = getPool().allocate(*rhs._root->_account);
+        _root->copy(rhs._root, *_pool);
+        _epoch = _pool->getEpoch();
+
+        //keep the same backend as rhs
+        if (rhs._table)
+            buildTable();
+        occupancy() = *rhs._occupancy;
 
     }return *this;
 }
 
+/**
+ * Overloaded move assignment operator, takes over the nodes of a DTree.
+ * The nodes stay in rhs's pool, so this tree shares that pool from now on.
+ * The compaction and rebalance settings of this tree are kept.
+ * @param rhs Source DTree, left empty
+ * @return this tree, holding what rhs held
+ */
+DTree& DTree::operator=(DTree&& rhs) {
+    if (this != &rhs) {
+        clear();
+
+        //rhs ends up with this tree's empty buffers and frees them itself
+        std::swap(_root, rhs._root);
+        std::swap(_table, rhs._table);
+        std::swap(_occupancy, rhs._occupancy);
+        std::swap(_frozenKeys, rhs._frozenKeys);
+        std::swap(_frozenNodes, rhs._frozenNodes);
+        std::swap(_frozenSize, rhs._frozenSize);
+        std::swap(_frozenCapacity, rhs._frozenCapacity);
+        std::swap(_frozen, rhs._frozen);
+        std::swap(_shared, rhs._shared);
+        _pool = rhs._pool;
+        _epoch = rhs._epoch;
+    }
+    return *this;
+}
+
 /**
  * Dynamically allocates a new DNode in the tree.
  * Should also update heights and detect imbalances in the traversal path
@@ -37,22 +92,183 @@ DTree& DTree::operator=(const DTree& rhs) {
  * @param newAcct Account object to be contained within the new DNode
  * @return true if the account was inserted, false otherwise
  */
-bool DTree::insert(Account newAcct) {
+bool DTree::insert(Account&& newAcct) {
+    int disc = newAcct._disc;
+    if (disc < MIN_DISC || disc > MAX_DISC)
+        return false;
+
     if (!_root) {
-        _root = new DNode(newAcct);
+        _root = getPool().allocate(std::move(newAcct));
+        _epoch = _pool->getEpoch();
+        occupancy().set(disc);
+        _frozen = false;
         return true;
     }
 
-    //check if user already exists
-    else if (retrieve(newAcct._disc))
+    //the occupancy bitmap answers the duplicate check without a descent
+    if (contains(disc))
         return false;
 
-    //insert user
-    else if (insertHelper(newAcct._disc, newAcct, _root)){
-        return true;
+    //one descent records the path, stopping early at a duplicate or at a
+    //vacant node the new disc can take over. As before, only vacant children
+    //are taken over, a vacant root is left for the next rebuild to drop.
+    //Every node the insert writes to is copied first if a snapshot shares it.
+    _path.clear();
+    DNode** link = &_root;
+    DNode* node = _root;
+    while (node) {
+        if (node->_disc == disc) {
+            if (!node->isVacant())
+                return false;
+            break;
+        }
+        if (node != _root && node->isVacant() && canFill(node, disc))
+            break;
+
+        node = own(*link);
+        _path.push_back(node);
+        link = (disc < node->_disc) ? &node->_left : &node->_right;
+        node = *link;
     }
-    else
+
+    if (node) {
+        //reuse the vacant node, sizes stay the same
+        node = own(*link);
+        *node->_account = std::move(newAcct);
+        node->_disc = disc;
+        node->_vacant = false;
+        node->_numVacant--;
+        for (unsigned int i = 0; i < _path.size(); i++)
+            _path[i]->_numVacant--;
+        setSlot(disc, node);
+    }
+    else {
+        //new leaf, every node on the path grows by one
+        node = _pool->allocate(std::move(newAcct));
+        *link = node;
+        setSlot(disc, node);
+
+        for (unsigned int i = 0; i < _path.size(); i++)
+            _path[i]->_size++;
+
+        //rebuilding the highest imbalanced node fixes everything below it.
+        //The vacant nodes it drops shrink the ancestors above, which can tip
+        //one of them over, so look again above the rebuilt node.
+        int top = _path.size();
+        for (int i = 0; i < top; i++) {
+            if (checkImbalance(_path[i])) {
+                rebalance(_path[i], i > 0 ? _path[i - 1] : nullptr);
+                for (int j = i - 1; j >= 0; j--) {
+                    updateSize(_path[j]);
+                    updateNumVacant(_path[j]);
+                }
+                top = i;
+                i = -1;
+            }
+        }
+    }
+
+    occupancy().set(disc);
+    _frozen = false;
+    updateBackend();
+    return true;
+}
+
+/**
+ * Builds the account straight from its fields and moves it into its node.
+ * @param username username of the account
+ * @param disc discriminator of the account
+ * @param nitro whether the account has nitro
+ * @param badge badge of the account
+ * @param status status of the account
+ * @return true if the account was inserted, false otherwise
+ */
+bool DTree::emplace(string username, int disc, bool nitro, string badge, string status) {
+    return insert(Account(std::move(username), disc, nitro, std::move(badge), std::move(status)));
+}
+
+//a vacant node can take disc if disc falls between its in-order neighbours
+bool DTree::canFill(DNode* node, int disc) {
+    DNode* left = node->_left;
+    while (left && left->_right)
+        left = left->_right;
+    if (left && left->_disc >= disc)
+        return false;
+
+    DNode* right = node->_right;
+    while (right && right->_left)
+        right = right->_left;
+    if (right && right->_disc <= disc)
         return false;
+
+    return true;
+}
+
+/**
+ * Inserts a batch of accounts and rebuilds the tree once, balanced.
+ * The batch is ordered by discriminator (the first account wins on
+ * duplicates), merged with the valid nodes already in the tree (which win
+ * over the batch), and handed to rebuild in a single pass. Vacant nodes are
+ * dropped along the way. The accounts are copied into their nodes, or
+ * moved when the batch is handed over as an rvalue.
+ * @param accounts Accounts to insert, in any order
+ * @param movable the same vector if its accounts may be moved from, nullptr to copy them
+ * @return number of accounts inserted
+ */
+int DTree::bulkLoad(const std::vector<Account>& accounts, std::vector<Account>* movable) {
+    std::vector<int> order;
+    sortByDisc(accounts, order);
+    if (order.empty())
+        return 0;
+
+    //flatten the current tree, same as a rebalance at the root
+    int size = 0;
+    if (_root) {
+        updateSize(_root);
+        updateNumVacant(_root);
+        size = getNumUsers();
+    }
+    DNode** existing = new DNode*[size];
+    int numExisting = 0;
+    if (_root) {
+        ownSubtree(_root);
+        _shared = false;
+        _root->rebalance(_root, existing, numExisting, getPool());
+    }
+
+    //merge both sorted runs, allocating nodes only for new discs
+    DNode** dtreeArray = new DNode*[numExisting + order.size()];
+    int total = 0;
+    int inserted = 0;
+    int i = 0;
+    unsigned int j = 0;
+    while (i < numExisting || j < order.size()) {
+        if (j == order.size() ||
+            (i < numExisting && existing[i]->getDiscriminator() <= accounts[order[j]]._disc)) {
+            if (j < order.size() && existing[i]->getDiscriminator() == accounts[order[j]]._disc)
+                j++;
+            dtreeArray[total++] = existing[i++];
+        }
+        else {
+            int k = order[j++];
+            DNode* node = movable ? getPool().allocate(std::move((*movable)[k])) : getPool().allocate(accounts[k]);
+            setSlot(node->getDiscriminator(), node);
+            occupancy().set(node->getDiscriminator());
+            dtreeArray[total++] = node;
+            inserted++;
+        }
+    }
+
+    if (!_root)
+        _epoch = _pool->getEpoch();
+    rebuild(dtreeArray, 0, total - 1, _root);
+
+    delete [] existing;
+    delete [] dtreeArray;
+
+    _frozen = false;
+    updateBackend();
+    return inserted;
 }
 
 /**
@@ -62,23 +278,37 @@ bool DTree::insert(Account newAcct) {
  * @return true if an account was removed, false otherwise
  */
 bool DTree::remove(int disc, DNode*& removed) {
+    if (!_root)
+        return false;
 
-    //desired node to remove is the root
-    if (_root->_account._disc == disc && !(_root->_vacant)) {
-        removed = _root;
-        _root->_vacant = true;
-        _root->_numVacant++;
-        return true;
-    }
+    //compact before marking, so the node handed back stays put until the next write
+    if (_inlineCompaction && needsCompaction())
+        compact();
 
-    else {
-        removed = removeHelper(disc, _root);
+    //the bitmap knows right away if the disc is missing
+    if (!contains(disc))
+        return false;
 
-	if (removed != nullptr) {
-            return true;
+    //the disc is there, so every node on the way down gains a vacancy.
+    //Nodes shared with a snapshot are copied before they change.
+    DNode** link = &_root;
+    while (true) {
+        DNode* node = own(*link);
+        node->_numVacant++;
+
+        if (node->_disc == disc && !(node->_vacant)) {
+            node->_vacant = true;
+            removed = node;
+            break;
         }
+        link = (disc < node->_disc) ? &node->_left : &node->_right;
     }
-    return false;
+
+    setSlot(disc, nullptr);
+    _occupancy->reset(disc);
+    _frozen = false;
+    updateBackend();
+    return true;
 }
 
 /**
@@ -87,9 +317,19 @@ bool DTree::remove(int disc, DNode*& removed) {
  * @return DNode with a matching discriminator, nullptr otherwise
  */
 DNode* DTree::retrieve(int disc) {
+    //dense trees index the slot directly
+    if (_table) {
+        if (disc < MIN_DISC || disc > MAX_DISC)
+            return nullptr;
+        return _table[disc - MIN_DISC];
+    }
+
+    if (_frozen)
+        return retrieveFrozen(disc);
+
     if (_root) {
       //node is root
-        if (_root->_account._disc == disc && !(_root->_vacant))
+        if (_root->_disc == disc && !(_root->_vacant))
             return _root;
 
         return _root->retrieve(disc, _root);
@@ -97,13 +337,55 @@ DNode* DTree::retrieve(int disc) {
     return nullptr;
 }
 
+/**
+ * Retrieves a batch of discriminators, sorted ascending. Discs the bitmap
+ * rules out are skipped, the rest share a single descent of the tree.
+ * @param discs discriminators to match, smallest first
+ * @param n number of discriminators
+ * @param found set to the matching DNode of each disc, or nullptr, in the same order
+ * @return number of DNodes found
+ */
+int DTree::retrieve(const int discs[], int n, DNode* found[]) {
+    int numFound = 0;
+    if (_table || _frozen || !_root) {
+        for (int i = 0; i < n; i++) {
+            found[i] = retrieve(discs[i]);
+            numFound += (found[i] != nullptr);
+        }
+        return numFound;
+    }
+
+    std::vector<int> present;
+    for (int i = 0; i < n; i++) {
+        found[i] = nullptr;
+        if (contains(discs[i]))
+            present.push_back(i);
+    }
+    DNode::retrieve(discs, present.data(), 0, present.size(), found, _root);
+    for (int i : present)
+        numFound += (found[i] != nullptr);
+    return numFound;
+}
+
 /**
  * Helper for the destructor to clear dynamic memory.
+ * A tree that is the only user of its pool drops every slab at once. If the
+ * pool moved on to a new epoch, its owner already reclaimed our nodes.
+ * Nodes still used by a snapshot are left to it.
  */
 void DTree::clear() {
-    if (_root) {
-        _root->clear(_root);
+    if (_root && _pool->getEpoch() == _epoch) {
+        if (_pool.use_count() == 1)
+            _pool->clear();
+        else
+            _root->clear(_root, *_pool);
     }
+    _root = nullptr;
+    _frozen = false;
+    _shared = false;
+    dropTable();
+    if (_occupancy)
+        _occupancy->clear();
 }
 
 /**
@@ -125,11 +407,201 @@ void DTree::dump(DNode* node) const {
     cout << ")";
 }
 
+/**
+ * Builds the read-optimized layout of the tree. The valid nodes are laid out
+ * in BFS order in one contiguous array, so retrieve walks down by index
+ * instead of chasing pointers. The layout is used until the next write.
+ */
+void DTree::freeze() {
+    if (_frozen)
+        return;
+
+    int size = _root ? getNumUsers() : 0;
+
+    //only grow the buffers, a refreeze after small writes reuses them
+    if (!_frozenKeys || size > _frozenCapacity) {
+        dropFrozen();
+        _frozenKeys = new short[size + 1];
+        _frozenNodes = new DNode*[size + 1];
+        _frozenCapacity = size;
+    }
+    _frozenSize = size;
+
+    DNode** dtreeArray = new DNode*[size];
+    int i = 0;
+    if (_root)
+        _root->flatten(_root, dtreeArray, i);
+
+    i = 0;
+    layout(dtreeArray, i, 1);
+    delete [] dtreeArray;
+
+    _frozen = true;
+}
+
+/**
+ * Takes a point-in-time copy of the tree in O(1). The copy shares every node
+ * with this tree and with the same pool; whichever of the two writes first
+ * copies just the nodes on its path, so the other keeps seeing the tree as
+ * it was. The copy starts out without a table or frozen layout.
+ * @return snapshot of the tree
+ */
+DTree DTree::snapshot() {
+    DTree copy(_pool);
+    if (_root) {
+        _root->_refs++;
+        copy._root = _root;
+        copy._epoch = _epoch;
+        copy.occupancy() = *_occupancy;
+        copy._shared = true;
+        _shared = true;
+    }
+    return copy;
+}
+
+/**
+ * Rebuilds the whole tree without its vacant nodes, returning them to the pool.
+ * Runs regardless of the compaction policy, needsCompaction() tells whether
+ * the policy calls for it. Vacant nodes a snapshot still shares stay with the
+ * snapshot, so they are not counted.
+ * @return bytes of node memory this tree actually frees
+ */
+size_t DTree::compact() {
+    if (!_root || _root->getNumVacant() == 0)
+        return 0;
+
+    int numFreed = _shared ? numOwnedVacant(_root) : _root->getNumVacant();
+    size_t reclaimed = numFreed * (sizeof(DNode) + sizeof(Account));
+    if (getNumUsers() == 0) {
+        clear();
+    }
+    else {
+        rebalance(_root, nullptr);
+        _shared = false;
+    }
+
+    _frozen = false;
+    return reclaimed;
+}
+
+/**
+ * Chooses how subtrees are rebuilt. In place threads the nodes through their
+ * own links, the array mode flattens into a temporary array sized to the subtree.
+ * @param mode REBALANCE_IN_PLACE (default) or REBALANCE_ARRAY
+ */
+void DTree::setRebalanceMode(RebalanceMode mode) {
+    _rebalanceMode = mode;
+}
+
+/**
+ * Sets when the tree counts as due for compaction and who runs it.
+ * @param vacancyRatio share of vacant nodes, from 0 to 1, that calls for compaction
+ * @param inlineCompaction true to compact from remove, false to leave it to a maintenance pass
+ */
+void DTree::setCompaction(double vacancyRatio, bool inlineCompaction) {
+    _vacancyRatio = vacancyRatio;
+    _inlineCompaction = inlineCompaction;
+}
+
+/**
+ * Checks the tree's vacant nodes against the compaction policy.
+ * @return true if the share of vacant nodes is over the vacancy ratio
+ */
+bool DTree::needsCompaction() const {
+    if (!_root || _root->getNumVacant() == 0)
+        return false;
+    return _root->getNumVacant() > _vacancyRatio * _root->getSize();
+}
+
+/**
+ * Finds the k-th smallest valid discriminator using the subtree counts.
+ * @param k position among the valid discriminators, starting from 0
+ * @return DNode holding that discriminator, nullptr if k is out of range
+ */
+DNode* DTree::select(int k) const {
+    DNode* node = _root;
+    while (node) {
+        int left = numValid(node->_left);
+        if (k < left) {
+            node = node->_left;
+        }
+        else if (!node->isVacant() && k == left) {
+            return node;
+        }
+        else {
+            k -= left + (node->isVacant() ? 0 : 1);
+            node = node->_right;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Counts the valid discriminators smaller than disc.
+ * @param disc discriminator to rank, need not be in the tree
+ * @return number of valid discriminators less than disc
+ */
+int DTree::rank(int disc) const {
+    int smaller = 0;
+    DNode* node = _root;
+    while (node) {
+        if (disc <= node->getDiscriminator()) {
+            node = node->_left;
+        }
+        else {
+            smaller += numValid(node->_left) + (node->isVacant() ? 0 : 1);
+            node = node->_right;
+        }
+    }
+    return smaller;
+}
+
+/**
+ * Counts the valid discriminators within a range.
+ * @param lo smallest discriminator of the range
+ * @param hi largest discriminator of the range, inclusive
+ * @return number of valid discriminators in [lo, hi]
+ */
+int DTree::countRange(int lo, int hi) const {
+    if (lo > hi)
+        return 0;
+    return rank(hi + 1) - rank(lo);
+}
+
+/**
+ * Finds the smallest discriminator not held by a valid node, in one descent.
+ * Going right means every disc from MIN_DISC up to the node is taken, which
+ * is exactly when the valid nodes before it number as many as those discs.
+ * @return lowest unused discriminator, INVALID_DISC if all are taken
+ */
+int DTree::lowestFreeDisc() const {
+    int taken = 0;      /* MIN_DISC .. MIN_DISC + taken - 1 are all valid */
+    DNode* node = _root;
+    while (node) {
+        int before = taken + numValid(node->_left);
+        if (before == node->getDiscriminator() - MIN_DISC) {
+            if (node->isVacant())
+                return node->getDiscriminator();
+            taken = before + 1;
+            node = node->_right;
+        }
+        else {
+            node = node->_left;
+        }
+    }
+
+    if (taken >= NUM_DISC)
+        return INVALID_DISC;
+    return MIN_DISC + taken;
+}
+
 /**
  * Returns the number of valid users in the tree.
  * @return number of non-vacant nodes
  */
 int DTree::getNumUsers() const {
+    if (!_root)
+        return 0;
     return (_root->getSize() - _root->getNumVacant());
 }
 
@@ -207,14 +679,25 @@ bool DTree::checkImbalance(DNode* node) {
  * @param node DNode root of the subtree to balance
  */
 void DTree::rebalance(DNode*& node) {
-    DNode *parent = _root;
-    bool isLeft = false;
-    bool isRoot = false;
+    DNode *parent = nullptr;
+
+    //the parent gets relinked too, so take the whole tree back from any snapshot
+    //first. node may then be a copy, found again by its discriminator; the
+    //caller's pointer may sit in a shared node and is left alone.
+    if (_shared) {
+        int disc = node->getDiscriminator();
+        ownSubtree(_root);
+        _shared = false;
+
+        DNode* copy = _root;
+        while (copy->getDiscriminator() != disc)
+            copy = (disc < copy->getDiscriminator()) ? copy->_left : copy->_right;
+        rebalance(copy);
+        return;
+    }
 
-    if (node == _root)
-      isRoot = true;
- 
-    else {
+    if (node != _root) {
+      parent = _root;
 
       while (parent->_left != node && parent->_right != node) {
 
@@ -225,38 +708,221 @@ void DTree::rebalance(DNode*& node) {
 	  parent = parent->_right;
         }
       }
+    }
 
-      if (parent->_left == node)
-        isLeft = true;
-      else if (parent->_right == node)
-        isLeft = false;
+    rebalance(node, parent);
+}
+
+//rebuild the subtree at node and hang it back off parent (nullptr for the root)
+void DTree::rebalance(DNode*& node, DNode* parent) {
+    bool isLeft = parent && parent->_left == node;
+
+    //the rebuild relinks and frees nodes, none of them may be shared
+    if (_shared)
+        ownSubtree(node);
+
+    if (_rebalanceMode == REBALANCE_IN_PLACE) {
+        //thread the valid nodes into a vine through their right links, then
+        //rebuild from it; nothing is allocated either way
+        DNode* head = nullptr;
+        DNode** tail = &head;
+        int size = 0;
+        toVine(node, tail, size);
+        *tail = nullptr;
+        node = fromVine(head, size);
     }
+    else {
+        updateSize(node);
+        updateNumVacant(node);
+        int size = node->getSize() - node->getNumVacant();
 
-    updateSize(node);
-    updateNumVacant(node);
-    int size = node->getSize() - node->getNumVacant();
+        DNode** dtreeArray;
+        dtreeArray = new DNode*[size];
 
-    DNode** dtreeArray;
-    dtreeArray = new DNode*[size];
+        int i = 0;
 
-    int i = 0;
+        node->rebalance(node, dtreeArray, i, *_pool);
 
-    node->rebalance(node, dtreeArray, i);
+        int start = 0;
+        int end = size - 1;
 
-    int start = 0;
-    int end = size - 1;
+        rebuild(dtreeArray, start, end, node);
+        if (size == 0)
+            node = nullptr;
 
-    rebuild(dtreeArray, start, end, node);
+        delete [] dtreeArray;
+    }
 
-    if (isRoot)
+    if (!parent)
       _root = node;
     else if (isLeft)
       parent->_left = node;
     else
       parent->_right = node;
+}
 
-    delete [] dtreeArray;
+//append the valid nodes of the subtree, in order, to the vine at tail
+void DTree::toVine(DNode* node, DNode**& tail, int &size) {
+    if (!node)
+        return;
+
+    DNode* right = node->_right;
+    toVine(node->_left, tail, size);
+
+    if (node->isVacant()) {
+        _pool->release(node);
+    }
+    else {
+        node->_left = nullptr;
+        *tail = node;
+        tail = &node->_right;
+        size++;
+    }
+
+    toVine(right, tail, size);
+}
+
+//same shape as rebuild: the middle node is the root, taken off the vine in order
+DNode* DTree::fromVine(DNode*& head, int size) {
+    if (size == 0)
+        return nullptr;
+
+    int leftSize = (size - 1) / 2;
+    DNode* left = fromVine(head, leftSize);
+
+    DNode* node = head;
+    head = head->_right;
+    node->_left = left;
+    node->_right = fromVine(head, size - 1 - leftSize);
+
+    updateSize(node);
+    updateNumVacant(node);
+    return node;
+}
+
+/**
+ * Starts a range scan at the first valid account with a discriminator of at least lo.
+ * @param root root of the tree to scan
+ * @param lo smallest discriminator of the range
+ * @param hi largest discriminator of the range, inclusive
+ */
+DRangeIterator::DRangeIterator(DNode* root, int lo, int hi) {
+    _next = nullptr;
+    _lo = lo;
+    _hi = hi;
+    pushLeft(root);
+    advance();
+}
+
+/**
+ * Hands out the current account and moves on to the next one in range.
+ * Only call while hasNext() is true.
+ * @return current account, valid until the next write to the tree
+ */
+const Account& DRangeIterator::next() {
+    DNode* node = _next;
+    advance();
+    return *node->_account;
+}
+
+//descend towards the smallest disc >= lo, skipping subtrees with nothing valid in them
+void DRangeIterator::pushLeft(DNode* node) {
+    while (node && node->_size != node->_numVacant) {
+        if (node->getDiscriminator() < _lo) {
+            node = node->_right;
+        }
+        else {
+            _stack.push_back(node);
+            node = node->_left;
+        }
+    }
+}
+
+void DRangeIterator::advance() {
+    _next = nullptr;
+    while (!_stack.empty()) {
+        DNode* node = _stack.back();
+        _stack.pop_back();
+
+        //everything left on the stack is larger still
+        if (node->getDiscriminator() > _hi) {
+            _stack.clear();
+            return;
+        }
+
+        pushLeft(node->_right);
+        if (!node->isVacant()) {
+            _next = node;
+            return;
+        }
+    }
+}
+
+/**
+ * Copy constructor, takes its own references to the badge and status.
+ * @param other Account to copy
+ */
+Account::Account(const Account& other) {
+    _username = other._username;
+    _disc = other._disc;
+    _flags = other._flags;
+    _badge = StringDict::global().acquire(other._badge);
+    _status = StringDict::global().acquire(other._status);
+}
 
+/**
+ * Move constructor, takes over the references, leaving other's badge and
+ * status empty.
+ * @param other Account to move from
+ */
+Account::Account(Account&& other) noexcept {
+    _username = std::move(other._username);
+    _disc = other._disc;
+    _flags = other._flags;
+    _badge = other._badge;
+    _status = other._status;
+    other._badge = 0;
+    other._status = 0;
+}
+
+/**
+ * Copy assignment, the new references are taken before the old ones go.
+ * @param other Account to copy
+ * @return this Account
+ */
+Account& Account::operator=(const Account& other) {
+    uint32_t badge = StringDict::global().acquire(other._badge);
+    uint32_t status = StringDict::global().acquire(other._status);
+    StringDict::global().release(_badge);
+    StringDict::global().release(_status);
+    _username = other._username;
+    _disc = other._disc;
+    _flags = other._flags;
+    _badge = badge;
+    _status = status;
+    return *this;
+}
+
+/**
+ * Move assignment, swaps the references so other releases the old ones.
+ * @param other Account to move from
+ * @return this Account
+ */
+Account& Account::operator=(Account&& other) noexcept {
+    _username = std::move(other._username);
+    _disc = other._disc;
+    _flags = other._flags;
+    std::swap(_badge, other._badge);
+    std::swap(_status, other._status);
+    return *this;
+}
+
+/**
+ * Destructor, drops the references to the badge and status.
+ */
+Account::~Account() {
+    StringDict::global().release(_badge);
+    StringDict::global().release(_status);
 }
 
 /**
@@ -274,168 +940,53 @@ ostream& operator<<(ostream& sout, const Account& acct) {
     return sout;
 }
 
-void DNode::clear(DNode* node) {
-    if (!node)
+void DNode::clear(DNode* node, DNodePool& pool) {
+    //a node a snapshot still uses stays, along with everything below it
+    if (!node || --node->_refs > 0)
         return;
 
-    clear(node->_left);
-    clear(node->_right);
-
-    node->_account._badge = "";
-    node->_account._disc = 0;
-    node->_account._nitro = false;
-    node->_account._status = "";
-    node->_account._username = "";
-
-    node->_numVacant = 0;
-    node->_size = 0;
-    node->_vacant = false;
+    clear(node->_left, pool);
+    clear(node->_right, pool);
 
-    delete node;
-    node = nullptr;
+    pool.release(node);
 }
 
-void DNode::copy(DNode* copy) {
+void DNode::copy(DNode* copy, DNodePool& pool) {
     _vacant = copy->_vacant;
     _numVacant = copy->_numVacant;
     _size = copy->_size;
 
     if (copy->_left) {
-        _left = new DNode(copy->_left->_account);
-        _left->copy(copy->_left);
+        _left = pool.allocate(*copy->_left->_account);
+        _left->copy(copy->_left, pool);
     }
     if (copy->_right) {
-        _right = new DNode(copy->_right->_account);
-        _right->copy(copy->_right);
+        _right = pool.allocate(*copy->_right->_account);
+        _right->copy(copy->_right, pool);
     }
 }
 
-bool DTree::insertHelper(int discToInsert, Account acctToInsert, DNode* node) {
-    bool temp = false;
-
-    if (discToInsert == node->_account._disc)
-        return false;
-
-    if (discToInsert > node->_account._disc){
-
-      // go to the right
-        if (node->_right){
-
-	  //insert at vacant node
-            if (node->_right->isVacant()) {
-	        DNode* right = node->_right->_right;
-	        DNode* left = node->_right->_left;
-
-	        delete node->_right;
-
-	        node->_right = new DNode(acctToInsert);
-	        node->_right->_right = right;
-	        node->_right->_left = left;
-
-	        node->_right->_vacant = false;
-	        node->_right->_numVacant--;
-
-	        updateSize(node);
-	        updateNumVacant(node);
-	        if (checkImbalance(node))
-		  rebalance(node);
-
-	        return true;
-            }
-            else {
-	      //recursion to the right
-                temp =  insertHelper(discToInsert, acctToInsert, node->_right);
-
-                updateSize(node);
-                updateNumVacant(node);
-                if (checkImbalance(node))
-                  rebalance(node);
-            }
-        }
-	//insert new leaf
-	else{
-            node->_right = new DNode(acctToInsert);
-
-            updateSize(node);
-            updateNumVacant(node);
-            if (checkImbalance(node))
-                rebalance(node);
-            return true;
-        }
-    }
-    else{
-        // go to the left
-        if ( node->_left){
-            //if the left is vacant, insert
-            if ( node->_left->isVacant()) {
-               	DNode* right = node->_left->_right;
-		DNode* left = node->_left->_left;
-
-		delete node->_left;
-
-		node->_left = new DNode(acctToInsert);
-		node->_left->_right = right;
-		node->_left->_left = left;
-
-		node->_left->_vacant = false;
-		node->_left->_numVacant--;
-
-		updateSize(node);
-		updateNumVacant(node);
-		if (checkImbalance(node))
-		  rebalance(node);
-
-		return true;
-            }
-            else {
-	      //recursion to the left
-                temp =  insertHelper(discToInsert, acctToInsert, node->_left);
-
-                updateSize(node);
-                updateNumVacant(node);
-                if (checkImbalance(node)) {
-                    rebalance(node);
-                }
-            }
-        }
-
-	//insert new leaf
-	else{
-            node->_left = new DNode(acctToInsert);
-
-            updateSize(node);
-            updateNumVacant(node);
-            if (checkImbalance(node))
-                rebalance(node);
-
-            return true;
-        }
-    }
-    
-    return temp;
-}
-
 DNode *DNode::retrieve(int disc, DNode* node) {
     DNode* temp;
 
     //node's disc matches
-    if (node && node->_account._disc == disc && !(node->_vacant))
+    if (node && node->_disc == disc && !(node->_vacant))
       return node;
   
     //left node matches disc
-    else if (node->_left && node->_left->_account._disc == disc && !(node->_left->_vacant))
+    else if (node->_left && node->_left->_disc == disc && !(node->_left->_vacant))
       return node->_left;
 
     //right node matches disc
-    else if (node->_right && node->_right->_account._disc == disc && !(node->_right->_vacant))
+    else if (node->_right && node->_right->_disc == disc && !(node->_right->_vacant))
       return node->_right;
 
     //disc is on left side
-    else if (node->_left && disc < node->_account._disc)
+    else if (node->_left && disc < node->_disc)
       temp = node->retrieve(disc, node->_left);
 
     //disc is on right side
-    else if (node->_right && disc > node->_account._disc)
+    else if (node->_right && disc > node->_disc)
       temp = node->retrieve(disc, node->_right);
 
     //disc not in tree
@@ -445,24 +996,51 @@ DNode *DNode::retrieve(int disc, DNode* node) {
     return temp;
 }
 
+//split the sorted discs picked out by which[lo, hi) around node, and carry
+//each side on down its subtree
+void DNode::retrieve(const int discs[], const int which[], int lo, int hi, DNode* found[], DNode* node) {
+    while (node && lo < hi) {
+        int mid = std::lower_bound(which + lo, which + hi, node->_disc, [discs](int i, int disc) {
+            return discs[i] < disc;
+        }) - which;
+        int end = mid;
+        while (end < hi && discs[which[end]] == node->_disc) {
+            if (!node->_vacant)
+                found[which[end]] = node;
+            end++;
+        }
+
+        retrieve(discs, which, lo, mid, found, node->_left);
+        lo = end;
+        node = node->_right;
+    }
+}
+
+//what a DNode outside any tree points at, so its getters still answer with
+//a default Account; tree code never writes through it
+Account* DNode::defaultAccount() {
+    static Account account;
+    return &account;
+}
+
 void DNode::print(DNode* nodeToPrint) {
     if (!nodeToPrint || nodeToPrint->isVacant())
         return;
 
     print(nodeToPrint->_left);
 
-    cout << nodeToPrint->_account << endl;
+    cout << *nodeToPrint->_account << endl;
 
     print(nodeToPrint->_right);
 }
 
 //add nodes to an array from smallest disc to largest
-void DNode::rebalance(DNode*& node, DNode* dtreeArray[], int &i) {
+void DNode::rebalance(DNode*& node, DNode* dtreeArray[], int &i, DNodePool& pool) {
     if (!node) {
         return;
     }
 
-    rebalance(node->_left, dtreeArray, i);
+    rebalance(node->_left, dtreeArray, i, pool);
 
     if (!node->isVacant()) {
         node->_size = 1;
@@ -471,10 +1049,10 @@ void DNode::rebalance(DNode*& node, DNode* dtreeArray[], int &i) {
         i++;
     }
 
-    rebalance(node->_right, dtreeArray, i);
+    rebalance(node->_right, dtreeArray, i, pool);
 
     if (node->isVacant()) {
-        delete node;
+        pool.release(node);
     }
 }
 
@@ -499,48 +1077,192 @@ DNode *DTree::rebuild(DNode* dtreeArray[], int start, int end, DNode*& node) {
     return node;
 }
 
-DNode* DTree::removeHelper(int disc, DNode* node) {
-    DNode* temp;
-
-    //node matches the disc
-    if (node && node->_account._disc == disc && !(node->_vacant)){
-      node->_vacant = true;
-      node->_numVacant += 1;
-      updateNumVacant(node);
-      return node;
-    }
-    
-    //left node matches disc
-    else if (node->_left && node->_left->_account._disc == disc && !(node->_left->_vacant)) {
-        node->_left->_vacant = true;
-        node->_left->_numVacant += 1;
-        updateNumVacant(node);
-        return node->_left;
+//copy the node at link if a snapshot shares it, so this tree can write to it
+DNode* DTree::own(DNode*& link) {
+    DNode* node = link;
+    if (node->_refs == 1)
+        return node;
+
+    DNode* copy = _pool->allocate(*node->_account);
+    copy->_size = node->_size;
+    copy->_numVacant = node->_numVacant;
+    copy->_vacant = node->_vacant;
+    copy->_left = node->_left;
+    copy->_right = node->_right;
+    if (copy->_left)
+        copy->_left->_refs++;
+    if (copy->_right)
+        copy->_right->_refs++;
+
+    //a snapshot on another thread may have let go in the meantime, leaving
+    //the original to us; drop it along with its hold on the children
+    if (--node->_refs == 0) {
+        if (node->_left)
+            node->_left->_refs--;
+        if (node->_right)
+            node->_right->_refs--;
+        _pool->release(node);
     }
 
-        //right node matches disc
-    else if (node->_right && node->_right->_account._disc == disc && !(node->_right->_vacant)) {
-        node->_right->_vacant = true;
-        node->_right->_numVacant += 1;
-        updateNumVacant(node);
-        return node->_right;
-    }
+    if (!copy->_vacant)
+        setSlot(copy->getDiscriminator(), copy);
+    link = copy;
+    return copy;
+}
 
-        //disc is on left side
-    else if (node->_left && disc < node->_account._disc) {
-        temp = removeHelper(disc, node->_left);
-        updateNumVacant(node);
-    }
+//own every node of the subtree
+void DTree::ownSubtree(DNode*& node) {
+    if (!node)
+        return;
+    own(node);
+    ownSubtree(node->_left);
+    ownSubtree(node->_right);
+}
 
-        //disc is on right side
-    else if (node->_right && disc > node->_account._disc) {
-        temp = removeHelper(disc, node->_right);
-        updateNumVacant(node);
+//vacant nodes below node that no snapshot shares, the ones freeing them frees memory
+int DTree::numOwnedVacant(DNode* node) const {
+    if (!node || node->_refs > 1 || node->getNumVacant() == 0)
+        return 0;
+    return node->isVacant() + numOwnedVacant(node->_left) + numOwnedVacant(node->_right);
+}
+
+/**
+ * Switches between the tree and the direct-indexed table based on population.
+ * The gap between the two thresholds keeps a tree hovering around one of them
+ * from rebuilding its table on every insert/remove.
+ */
+void DTree::updateBackend() {
+    if (!_table && getNumUsers() >= DENSE_THRESHOLD)
+        buildTable();
+    else if (_table && getNumUsers() < SPARSE_THRESHOLD)
+        dropTable();
+}
+
+//standalone trees get a pool of their own on first use
+DNodePool& DTree::getPool() {
+    if (!_pool)
+        _pool = std::make_shared<DNodePool>();
+    return *_pool;
+}
+
+DiscBitmap& DTree::occupancy() {
+    if (!_occupancy)
+        _occupancy = new DiscBitmap();
+    return *_occupancy;
+}
+
+//allocate the table and point every valid disc at its node
+void DTree::buildTable() {
+    if (!_table)
+        _table = new DNode*[NUM_DISC]();
+    fillTable(_root);
+}
+
+void DTree::fillTable(DNode* node) {
+    if (!node)
+        return;
+
+    fillTable(node->_left);
+    if (!node->isVacant())
+        setSlot(node->getDiscriminator(), node);
+    fillTable(node->_right);
+}
+
+void DTree::dropTable() {
+    delete [] _table;
+    _table = nullptr;
+}
+
+//fill slot k and its subtree in BFS order from the sorted array
+void DTree::layout(DNode* dtreeArray[], int &i, int k) {
+    if (k > _frozenSize)
+        return;
+
+    layout(dtreeArray, i, 2 * k);
+    _frozenKeys[k] = dtreeArray[i]->getDiscriminator();
+    _frozenNodes[k] = dtreeArray[i];
+    i++;
+    layout(dtreeArray, i, 2 * k + 1);
+}
+
+/**
+ * Branch-free search of the frozen layout. Every step goes to 2k or 2k+1;
+ * once k falls off the array, the ones trailing the last left turn are shifted
+ * off to land on the smallest key not less than disc.
+ */
+DNode* DTree::retrieveFrozen(int disc) const {
+    int k = 1;
+    //the last levels have no descendants that far down, and pointing past
+    //the array is undefined even for a prefetch, so they skip it
+    int lastPrefetch = _frozenSize / FROZEN_PREFETCH;
+    while (k <= _frozenSize) {
+        if (k <= lastPrefetch)
+            __builtin_prefetch(_frozenKeys + FROZEN_PREFETCH * k);
+        k = 2 * k + (_frozenKeys[k] < disc);
     }
+    k >>= __builtin_ffs(~k);
 
-        //disc not in tree
-    else
-        return nullptr;
+    if (k && _frozenKeys[k] == disc)
+        return _frozenNodes[k];
+    return nullptr;
+}
 
-    return temp;
+void DTree::dropFrozen() {
+    delete [] _frozenKeys;
+    delete [] _frozenNodes;
+    _frozenKeys = nullptr;
+    _frozenNodes = nullptr;
+    _frozenSize = 0;
+    _frozenCapacity = 0;
+    _frozen = false;
+}
+
+//add the valid nodes to an array from smallest disc to largest, leaving the tree as is
+void DNode::flatten(DNode* node, DNode* dtreeArray[], int &i) {
+    if (!node)
+        return;
+
+    flatten(node->_left, dtreeArray, i);
+    if (!node->isVacant())
+        dtreeArray[i++] = node;
+    flatten(node->_right, dtreeArray, i);
+}
+
+/**
+ * Puts the indices of the valid accounts in discriminator order, keeping only
+ * the first account for each disc. Small batches are sorted, large ones are
+ * bucketed by disc which is linear since discs are bounded.
+ */
+void DTree::sortByDisc(const std::vector<Account>& accounts, std::vector<int>& order) {
+    order.clear();
+
+    if (accounts.size() < BULK_SORT_LIMIT) {
+        for (unsigned int i = 0; i < accounts.size(); i++) {
+            if (accounts[i]._disc >= MIN_DISC && accounts[i]._disc <= MAX_DISC)
+                order.push_back(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [&accounts](int a, int b) {
+            return accounts[a]._disc < accounts[b]._disc;
+        });
+
+        //stable, so the first of each run is the first in the batch
+        unsigned int kept = 0;
+        for (unsigned int i = 0; i < order.size(); i++) {
+            if (kept == 0 || accounts[order[kept - 1]]._disc != accounts[order[i]]._disc)
+                order[kept++] = order[i];
+        }
+        order.resize(kept);
+        return;
+    }
+
+    std::vector<int> first(NUM_DISC, -1);
+    for (unsigned int i = 0; i < accounts.size(); i++) {
+        int disc = accounts[i]._disc;
+        if (disc >= MIN_DISC && disc <= MAX_DISC && first[disc - MIN_DISC] == -1)
+            first[disc - MIN_DISC] = i;
+    }
+    for (int disc = 0; disc < NUM_DISC; disc++) {
+        if (first[disc] != -1)
+            order.push_back(first[disc]);
+    }
 }
@@ -10,6 +10,14 @@
 #include <iostream>
 #include <string>
 #include <exception>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include "pool.h"
+#include "strdict.h"
+#include "disc.h"
+#include "bitmap.h"
 
 using std::cout;
 using std::endl;
@@ -17,17 +25,24 @@ using std::string;
 using std::ostream;
 
 #define DEFAULT_USERNAME ""
-#define INVALID_DISC -1
-#define MIN_DISC 0000
-#define MAX_DISC 9999
 #define DEFAULT_BADGE ""
 #define DEFAULT_STATUS ""
+#define NITRO_FLAG 0x01
 
 #define DEFAULT_SIZE 1
 #define DEFAULT_NUM_VACANT 0
 
+#define DENSE_THRESHOLD 512     /* switch to the direct-indexed table at this many users */
+#define SPARSE_THRESHOLD 128    /* drop the table again below this many users */
+#define FROZEN_PREFETCH 32      /* keys per cache line, descendants 5 levels down */
+#define BULK_SORT_LIMIT 1024    /* smaller batches sort, larger ones bucket by disc */
+#define DEFAULT_VACANCY_RATIO 0.5   /* compact once this share of the nodes is vacant */
+
+enum RebalanceMode {REBALANCE_IN_PLACE, REBALANCE_ARRAY};
+
 class Grader;   /* For grading purposes */
 class Tester;   /* Forward declaration for testing class */
+class DNodePool;
 
 class Account {
 public:
@@ -35,12 +50,13 @@ public:
     friend class Tester;
     friend class DNode;
     friend class DTree;
+    friend class UTree;
     Account() {
         _username = DEFAULT_USERNAME;
         _disc = INVALID_DISC;
-        _nitro = false;
-        _badge = DEFAULT_BADGE;
-        _status = DEFAULT_STATUS;
+        _flags = 0;
+        _badge = 0;
+        _status = 0;
     }
 
     Account(string username, int disc, bool nitro, string badge, string status) {
@@ -48,26 +64,35 @@ public:
             throw std::out_of_range("Discriminator out of valid range (" + std::to_string(MIN_DISC)
                                     + "-" + std::to_string(MAX_DISC) + ")");
         }
-        _username = username;
+        _username = std::move(username);
         _disc = disc;
-        _nitro = nitro;
-        _badge = badge;
-        _status = status;
+        _flags = nitro ? NITRO_FLAG : 0;
+        _badge = StringDict::global().intern(badge);
+        _status = StringDict::global().intern(status);
     }
 
+    /* The badge and status ids are counted references into the StringDict */
+    Account(const Account& other);
+    Account(Account&& other) noexcept;
+    Account& operator=(const Account& other);
+    Account& operator=(Account&& other) noexcept;
+    ~Account();
+
     /* Getters */
-    string getUsername() const {return _username;}
+    const string& getUsername() const {return _username;}
     int getDiscriminator() const {return _disc;}
-    bool hasNitro() const {return _nitro;}
-    string getBadge() const {return _badge;}
-    string getStatus() const {return _status;}
+    bool hasNitro() const {return _flags & NITRO_FLAG;}
+    const string& getBadge() const {return StringDict::global().lookup(_badge);}
+    const string& getStatus() const {return StringDict::global().lookup(_status);}
 
 private:
+    /* Badges and statuses repeat across accounts, so they are kept once in
+     * the shared StringDict and referred to by id. */
     string _username;
-    int _disc;
-    bool _nitro;
-    string _badge;
-    string _status;
+    uint32_t _badge;
+    uint32_t _status;
+    short _disc;
+    uint8_t _flags;
 };
 
 /* Overloaded << operator to print Accounts */
@@ -77,74 +102,189 @@ class DNode {
     friend class Grader;
     friend class Tester;
     friend class DTree;
+    friend class DRangeIterator;
+    friend class DNodePool;
 
 public:
     DNode() {
+        _account = defaultAccount();
         _size = DEFAULT_SIZE;
         _numVacant = DEFAULT_NUM_VACANT;
+        _disc = INVALID_DISC;
         _vacant = false;
+        _refs = 1;
         _left = nullptr;
         _right = nullptr;
     }
 
-    DNode(Account account) {
+    DNode(Account* account) {
         _account = account;
         _size = DEFAULT_SIZE;
         _numVacant = DEFAULT_NUM_VACANT;
+        _disc = account->_disc;
         _vacant = false;
+        _refs = 1;
         _left = nullptr;
         _right = nullptr;
     }
 
     /* Getters */
-    Account getAccount() const {return _account;}
+    Account getAccount() const {return *_account;}
     int getSize() const {return _size;}
     int getNumVacant() const {return _numVacant;}
     bool isVacant() const {return _vacant;}
-    string getUsername() const {return _account.getUsername();}
-    int getDiscriminator() const {return _account.getDiscriminator();}
+    string getUsername() const {return _account->getUsername();}
+    int getDiscriminator() const {return _disc;}
 
 private:
-    Account _account;
+    /* Only what a descent looks at lives in the node, the Account is kept out
+     * of line and read on a hit. _disc mirrors _account->_disc. */
+    Account* _account;
+    DNode* _left;
+    DNode* _right;
     int _size;
     int _numVacant;
+    std::atomic<int> _refs;     /* trees and parents pointing here, more than 1 once a snapshot shares it */
+    short _disc;
     bool _vacant;
-    DNode* _left;
-    DNode* _right;
 
     /* IMPLEMENT (optional): any other helper functions */
-    void clear(DNode* node);
-    void copy(DNode* copy);
+    void clear(DNode* node, DNodePool& pool);
+    void copy(DNode* copy, DNodePool& pool);
   DNode* retrieve(int disc, DNode* node);
+    static void retrieve(const int discs[], const int which[], int lo, int hi, DNode* found[], DNode* node);
     void print(DNode* nodeToPrint);
-    void rebalance(DNode*& node, DNode* dtreeArray[], int &i);
+    static Account* defaultAccount();
+    void rebalance(DNode*& node, DNode* dtreeArray[], int &i, DNodePool& pool);
+    void flatten(DNode* node, DNode* dtreeArray[], int &i);
    
 };
 
+/**
+ * Hands out DNodes along with their out-of-line Accounts, each from a slab
+ * pool of its own. One DNodePool is shared by all the DTrees of a UTree, so
+ * with locking on, trees written from different threads can share it too.
+ */
+class DNodePool {
+public:
+    DNodePool(): _locking(false) {}
+
+    template <class A>
+    DNode* allocate(A&& account) {
+        std::unique_lock<std::mutex> guard(_lock, std::defer_lock);
+        if (_locking)
+            guard.lock();
+        return _nodes.allocate(_accounts.allocate(std::forward<A>(account)));
+    }
+
+    void release(DNode* node) {
+        if (!node)
+            return;
+        std::unique_lock<std::mutex> guard(_lock, std::defer_lock);
+        if (_locking)
+            guard.lock();
+        _accounts.release(node->_account);
+        _nodes.release(node);
+    }
+
+    /* Only switch while no other thread is using the pool */
+    void setLocking(bool locking) {_locking = locking;}
+
+    void clear() {
+        _nodes.clear();
+        _accounts.clear();
+    }
+
+    /* Getters */
+    int getNumLive() const {return _nodes.getNumLive();}
+    unsigned int getEpoch() const {return _nodes.getEpoch();}
+
+private:
+    NodePool<DNode> _nodes;
+    NodePool<Account> _accounts;
+    std::mutex _lock;
+    bool _locking;
+};
+
+/**
+ * Walks the valid accounts of a DTree with discriminators in [lo, hi], in order.
+ * Accounts are handed out by reference, so any write to the tree invalidates
+ * the iterator.
+ */
+class DRangeIterator {
+public:
+    DRangeIterator(DNode* root, int lo, int hi);
+
+    bool hasNext() const {return _next != nullptr;}
+    const Account& next();
+
+private:
+    std::vector<DNode*> _stack;     /* nodes whose right subtree is still to come */
+    DNode* _next;
+    int _lo;
+    int _hi;
+
+    void pushLeft(DNode* node);
+    void advance();
+};
+
 class DTree {
     friend class Grader;
     friend class Tester;
 
 public:
-    DTree(): _root(nullptr) {}
+    DTree(): _root(nullptr), _table(nullptr), _epoch(0),
+             _frozenKeys(nullptr), _frozenNodes(nullptr), _frozenSize(0), _frozenCapacity(0), _frozen(false),
+             _vacancyRatio(DEFAULT_VACANCY_RATIO), _inlineCompaction(false), _rebalanceMode(REBALANCE_IN_PLACE),
+             _occupancy(nullptr), _shared(false) {}
+    DTree(std::shared_ptr<DNodePool> pool): _root(nullptr), _table(nullptr), _pool(pool), _epoch(0),
+             _frozenKeys(nullptr), _frozenNodes(nullptr), _frozenSize(0), _frozenCapacity(0), _frozen(false),
+             _vacancyRatio(DEFAULT_VACANCY_RATIO), _inlineCompaction(false), _rebalanceMode(REBALANCE_IN_PLACE),
+             _occupancy(nullptr), _shared(false) {}
+
+    DTree(const DTree& rhs);
+    DTree(DTree&& rhs);
 
     /* IMPLEMENT: destructor and assignment operator*/
     ~DTree();
     DTree& operator=(const DTree& rhs);
+    DTree& operator=(DTree&& rhs);
 
     /* IMPLEMENT: Basic operations */
 
-    bool insert(Account newAcct);
+    bool insert(const Account& newAcct) {return insert(Account(newAcct));}
+    bool insert(Account&& newAcct);
+    bool emplace(string username, int disc, bool nitro, string badge, string status);
+    int bulkLoad(const std::vector<Account>& accounts) {return bulkLoad(accounts, nullptr);}
+    int bulkLoad(std::vector<Account>&& accounts) {return bulkLoad(accounts, &accounts);}
     bool remove(int disc, DNode*& removed);
     DNode* retrieve(int disc);
+    int retrieve(const int discs[], int n, DNode* found[]);
     void clear();
     void printAccounts() const;
     void dump() const {dump(_root);}
     void dump(DNode* node) const;
+    void freeze();
+    DTree snapshot();
+
+    /* Order statistics over the valid discriminators */
+    DNode* select(int k) const;
+    int rank(int disc) const;
+    int countRange(int lo, int hi) const;
+    int lowestFreeDisc() const;
+    DRangeIterator scan(int lo, int hi) const {return DRangeIterator(_root, lo, hi);}
+    size_t compact();
+    void setCompaction(double vacancyRatio, bool inlineCompaction);
+    void setRebalanceMode(RebalanceMode mode);
 
     /* IMPLEMENT: "Helper" functions */
 
     int getNumUsers() const;
+    bool isDense() const {return _table != nullptr;}
+    bool isFrozen() const {return _frozen;}
+    bool needsCompaction() const;
+    bool contains(int disc) const {return _occupancy && _occupancy->test(disc);}
+    const DiscBitmap* getOccupancy() const {return _occupancy;}
     string getUsername() const {return _root->getUsername();}
     void updateSize(DNode* node);
     void updateNumVacant(DNode* node);
@@ -157,9 +297,45 @@ public:
 
 private:
     DNode* _root;
+    DNode** _table;     /* slot per discriminator, only allocated while dense */
+    std::shared_ptr<DNodePool> _pool;   /* may be shared with the other trees of a UTree */
+    unsigned int _epoch;                /* pool epoch _root was allocated in */
+    std::vector<DNode*> _path;          /* reused by insert for the descent */
+
+    /* Read-optimized copy of the valid nodes in BFS (Eytzinger) order, index 1
+     * is the root. Any write marks it stale, the buffers are kept for reuse. */
+    short* _frozenKeys;
+    DNode** _frozenNodes;
+    int _frozenSize;
+    int _frozenCapacity;
+    bool _frozen;
+
+    double _vacancyRatio;       /* share of vacant nodes that calls for compaction */
+    bool _inlineCompaction;     /* compact from remove instead of waiting for a maintenance pass */
+    RebalanceMode _rebalanceMode;
+    DiscBitmap* _occupancy;     /* bit per valid disc, allocated with the first account */
+    bool _shared;               /* some nodes may be shared with a snapshot */
 
     /* IMPLEMENT (optional): any additional helper functions here */
-    bool insertHelper(int, Account, DNode*);
-    DNode* removeHelper(int, DNode*);
+    bool canFill(DNode* node, int disc);
+    void rebalance(DNode*& node, DNode* parent);
+    void toVine(DNode* node, DNode**& tail, int &size);
+    DNode* fromVine(DNode*& head, int size);
+    DNode* own(DNode*& link);
+    void ownSubtree(DNode*& node);
+    int numOwnedVacant(DNode* node) const;
     DNode* rebuild(DNode* dtreeArray[], int start, int end, DNode*& node);
+    DNodePool& getPool();
+    DiscBitmap& occupancy();
+    void buildTable();
+    void fillTable(DNode* node);
+    void dropTable();
+    void updateBackend();
+    static int numValid(DNode* node) {return node ? node->_size - node->_numVacant : 0;}
+    void setSlot(int disc, DNode* node) {if (_table) _table[disc - MIN_DISC] = node;}
+    void sortByDisc(const std::vector<Account>& accounts, std::vector<int>& order);
+    int bulkLoad(const std::vector<Account>& accounts, std::vector<Account>* movable);
+    void layout(DNode* dtreeArray[], int &i, int k);
+    DNode* retrieveFrozen(int disc) const;
+    void dropFrozen();
 };
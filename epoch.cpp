@@ -0,0 +1,109 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * EpochDomain.cpp
+ * Implementation for the EpochDomain class.
+ */
+
+#include "epoch.h"
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+/* The calling thread's slot in the global domain, handed back when the thread exits */
+struct ThreadSlot {
+    int _slot = -1;
+    int _depth = 0;
+
+    ~ThreadSlot() {
+        if (_slot >= 0)
+            EpochDomain::global().releaseSlot(_slot);
+    }
+};
+
+static thread_local ThreadSlot threadSlot;
+
+/**
+ * Starts at epoch 1, 0 marks a slot that is not reading.
+ */
+EpochDomain::EpochDomain(): _epoch(1) {
+    for (int i = 0; i < MAX_READERS; i++) {
+        _slots[i]._pinned = 0;
+        _slots[i]._used = false;
+    }
+}
+
+/**
+ * Pins the calling thread at the current epoch. Nested calls only count.
+ */
+void EpochDomain::enter() {
+    if (threadSlot._depth++ > 0)
+        return;
+    if (threadSlot._slot < 0)
+        threadSlot._slot = claimSlot();
+
+    //the pin has to be visible before any pointer the read loads, or a
+    //writer scanning the slots could free what the read is about to reach
+    _slots[threadSlot._slot]._pinned.store(_epoch.load());
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/**
+ * Unpins the calling thread once its outermost enter() is matched.
+ */
+void EpochDomain::exit() {
+    if (--threadSlot._depth == 0)
+        _slots[threadSlot._slot]._pinned.store(0, std::memory_order_release);
+}
+
+/**
+ * Finds the oldest epoch still pinned.
+ * @return epoch below which every retire() stamp is safe to free
+ */
+unsigned long EpochDomain::safeEpoch() const {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    unsigned long safe = _epoch.load();
+    for (int i = 0; i < MAX_READERS; i++) {
+        unsigned long pinned = _slots[i]._pinned.load();
+        if (pinned != 0 && pinned < safe)
+            safe = pinned;
+    }
+    return safe;
+}
+
+/**
+ * Waits until every thread that was reading when called has finished. The
+ * calling thread must not be pinned itself.
+ */
+void EpochDomain::synchronize() {
+    //readers pinning from here on see a later epoch and don't hold us up
+    unsigned long now = _epoch.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int i = 0; i < MAX_READERS; i++) {
+        unsigned long pinned = _slots[i]._pinned.load();
+        while (pinned != 0 && pinned <= now) {
+            std::this_thread::yield();
+            pinned = _slots[i]._pinned.load();
+        }
+    }
+}
+
+/**
+ * The domain lock-free UTree reads share.
+ * @return process-wide EpochDomain
+ */
+EpochDomain& EpochDomain::global() {
+    static EpochDomain domain;
+    return domain;
+}
+
+//claim a free slot for the calling thread
+int EpochDomain::claimSlot() {
+    for (int i = 0; i < MAX_READERS; i++) {
+        bool expected = false;
+        if (!_slots[i]._used.load() && _slots[i]._used.compare_exchange_strong(expected, true))
+            return i;
+    }
+    threadSlot._depth--;
+    throw std::length_error("More than " + std::to_string(MAX_READERS) + " threads reading at once");
+}
@@ -0,0 +1,64 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * EpochDomain.h
+ * Epoch-based reclamation for the lock-free read mode of UTree.
+ */
+
+#pragma once
+
+#include <atomic>
+
+#define MAX_READERS 128     /* threads that can read lock-free, a slot each until the thread exits */
+#define RETIRE_BATCH 64     /* retired objects a writer lets pile up before reclaiming */
+
+/**
+ * Tracks which threads may still be reading lock-free structures. A reader
+ * pins itself with enter() before loading any shared pointer and unpins with
+ * exit(); pins nest. A writer unlinks an object first, then stamps it with
+ * retire(), and may free it once the stamp is below safeEpoch(): every reader
+ * pinned at that point has pinned after the object was unreachable.
+ */
+class EpochDomain {
+public:
+    EpochDomain();
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    void enter();
+    void exit();
+    unsigned long retire() {return _epoch.fetch_add(1);}
+    unsigned long safeEpoch() const;
+    void synchronize();
+    void releaseSlot(int slot) {_slots[slot]._used.store(false);}
+
+    static EpochDomain& global();
+
+private:
+    /* One cache line per thread, so pinning never bounces a line between readers */
+    struct alignas(64) Slot {
+        std::atomic<unsigned long> _pinned;     /* epoch seen at enter(), 0 while not reading */
+        std::atomic<bool> _used;
+    };
+
+    std::atomic<unsigned long> _epoch;
+    Slot _slots[MAX_READERS];
+
+    int claimSlot();
+};
+
+/**
+ * Keeps the calling thread pinned for as long as it is in scope, so nodes
+ * handed out by a lock-free read stay valid. The first guard on a thread
+ * claims one of the MAX_READERS slots, kept until the thread exits; with
+ * none left the constructor throws std::length_error and nothing is pinned.
+ */
+class EpochGuard {
+public:
+    EpochGuard() {EpochDomain::global().enter();}
+    ~EpochGuard() {EpochDomain::global().exit();}
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
@@ -1,7 +1,14 @@
 #include "utree.h"
 #include "dtree.h"
+#include "btree.h"
+#include "snapshot.h"
+#include "wal.h"
 
 #include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
 
 #define NUMACCTS 20
 #define RANDDISC (distAcct(rng))
@@ -23,6 +30,39 @@ public:
     bool testRemoveInsert(DTree &dtree);
     bool testBSTProperty(DTree &dtree);
     bool checkBST(DNode *node);
+    bool testDenseBackend(DTree &dtree);
+    bool testFrozenLayout(DTree &dtree);
+    bool testBulkLoad(DTree &dtree, int numAccts);
+    bool checkBalanced(DTree &dtree, DNode *node);
+    bool testInsertRemoveChurn(DTree &dtree);
+    bool testCompaction(DTree &dtree);
+    bool testRebalanceModes(DTree &inPlace, DTree &array);
+    bool sameShape(DNode *lhs, DNode *rhs);
+    bool testOrderStatistics(DTree &dtree);
+    bool testLowestFreeDisc(UTree &utree);
+    bool testRangeScan(DTree &dtree);
+    bool testOccupancyBitmap(UTree &utree);
+    bool testMoveSemantics(DTree &dtree);
+    bool testMoveInsert(UTree &utree);
+    bool testSnapshots(DTree &dtree);
+    bool testUTreeSnapshot(UTree &utree);
+    bool testInternedAccounts();
+    bool testNodePayloads(DTree &dtree);
+    bool checkPayloads(DNode *node);
+    bool testBTree(DBTree &btree);
+    template <class T> void runDiscWorkload(T &tree, std::vector<int> &trace);
+    bool testConcurrentUTree(UTree &utree);
+    bool testLockFreeReads(UTree &utree);
+    bool checkUTreeAVL(UNode *node, int &height);
+    bool testParallelLoad(UTree &utree);
+    bool testMappedLoad(UTree &utree);
+    bool testSnapshotFile(UTree &utree);
+    bool testWriteLog(UTree &utree);
+    bool testInsertBatch(UTree &utree);
+    bool testMultiGet(UTree &utree);
+    bool testHashIndex(UTree &utree);
+    bool checkHashIndex(UTree &utree);
+    bool testKeyPrefix(UTree &utree);
 
     bool testBasicUTreeInsert(UTree& utree);
     bool testUTreeBalance(UTree& uTree);
@@ -31,6 +71,8 @@ public:
     bool checkUTreeBST(UNode *node);
     bool testUTreeRemoveRoot(UTree& utree);
     bool testUTreeRemoval(UTree& utree);
+    bool testUTreeReload(UTree& utree);
+    bool testUTreeCompaction(UTree& utree);
 };
 
 
@@ -116,7 +158,7 @@ bool Tester::testOverloadedAssignment(DTree& assign, DTree& dtree) {
 bool Tester::overload(DNode* lhs, DNode* rhs) {
     bool deepCopy = true;
 
-    if (lhs == rhs || lhs->_account._disc != rhs->_account._disc)
+    if (lhs == rhs || lhs->_disc != rhs->_disc)
         return false;
 
     if (rhs->_left)
@@ -265,6 +307,386 @@ bool Tester::checkBST(DNode *node) {
         return false;
 }
 
+bool Tester::testDenseBackend(DTree &dtree) {
+    //fill up to the threshold, tree should switch to the table
+    for (int i = 0; i < DENSE_THRESHOLD; i++) {
+        Account acct = Account("Dense", i * 3, 0, "", "");
+        dtree.insert(acct);
+    }
+    if (!dtree.isDense() || dtree.getNumUsers() != DENSE_THRESHOLD)
+        return false;
+
+    //every disc should come straight from the table
+    for (int i = 0; i < DENSE_THRESHOLD * 3; i++) {
+        DNode* node = dtree.retrieve(i);
+        if ((i % 3 == 0) != (node != nullptr))
+            return false;
+        if (node && node->getDiscriminator() != i)
+            return false;
+    }
+
+    //removing should clear the slot, and enough removals switch back
+    DNode* removed;
+    for (int i = 0; i < DENSE_THRESHOLD; i += 2) {
+        if (!dtree.remove(i * 3, removed) || dtree.retrieve(i * 3))
+            return false;
+    }
+    if (dtree.remove(0, removed))
+        return false;
+
+    int next = 1;
+    while (dtree.isDense()) {
+        dtree.remove(next * 3, removed);
+        next += 2;
+    }
+    if (dtree.getNumUsers() >= SPARSE_THRESHOLD)
+        return false;
+
+    //tree lookups should agree with what the table held
+    for (int i = 1; i < DENSE_THRESHOLD; i += 2) {
+        DNode* node = dtree.retrieve(i * 3);
+        if ((i >= next) != (node != nullptr))
+            return false;
+    }
+    return true;
+}
+
+bool Tester::testFrozenLayout(DTree &dtree) {
+    bool inserted[1000] = {false};
+    for (int i = 0; i < 100; i++) {
+        Account acct = Account("Frozen", (i * 37) % 1000, 0, "", "");
+        dtree.insert(acct);
+        inserted[(i * 37) % 1000] = true;
+    }
+    DNode* removed;
+    dtree.remove(37, removed);
+    inserted[37] = false;
+
+    dtree.freeze();
+    if (!dtree.isFrozen())
+        return false;
+
+    //frozen lookups must match the tree for hits, misses and vacant nodes
+    for (int i = 0; i < 1000; i++) {
+        DNode* node = dtree.retrieve(i);
+        if (inserted[i] != (node != nullptr))
+            return false;
+        if (node && node->getDiscriminator() != i)
+            return false;
+    }
+    if (dtree.retrieve(-1) || dtree.retrieve(MAX_DISC))
+        return false;
+
+    //a write goes back to the mutable tree
+    Account acct = Account("Frozen", 5000, 0, "", "");
+    dtree.insert(acct);
+    if (dtree.isFrozen() || !dtree.retrieve(5000))
+        return false;
+
+    dtree.freeze();
+    return dtree.retrieve(5000) && !dtree.retrieve(37) && dtree.retrieve(74);
+}
+
+bool Tester::testBulkLoad(DTree &dtree, int numAccts) {
+    std::vector<Account> accounts;
+    bool inserted[MAX_DISC + 1] = {false};
+    int numInserted = 0;
+    for (int i = 0; i < numAccts; i++) {
+        int disc = RANDDISC;
+        accounts.push_back(Account("Bulk", disc, 0, "", inserted[disc] ? "dup" : "first"));
+        if (!inserted[disc])
+            numInserted++;
+        inserted[disc] = true;
+    }
+
+    if (dtree.bulkLoad(accounts) != numInserted || dtree.getNumUsers() != numInserted)
+        return false;
+    if (!checkBalanced(dtree, dtree._root))
+        return false;
+
+    //first account wins on duplicates
+    for (int disc = 0; disc <= MAX_DISC; disc++) {
+        DNode* node = dtree.retrieve(disc);
+        if (inserted[disc] != (node != nullptr))
+            return false;
+        if (node && node->getAccount().getStatus() != "first")
+            return false;
+    }
+
+    //loading into a tree with vacancies keeps the existing accounts; handed
+    //over as an rvalue, only the accounts that go in are moved from
+    DNode* removed;
+    dtree.remove(accounts[0].getDiscriminator(), removed);
+    std::vector<Account> more;
+    more.push_back(Account("Bulk loaded, kept out", accounts[1].getDiscriminator(), 0, "", "dup"));
+    more.push_back(Account("Bulk loaded, moved in", accounts[0].getDiscriminator(), 0, "", "again"));
+    if (dtree.bulkLoad(std::move(more)) != 1 || dtree._root->getNumVacant() != 0)
+        return false;
+    if (more[0].getUsername() != "Bulk loaded, kept out" || !more[1].getUsername().empty() ||
+        dtree.retrieve(accounts[0].getDiscriminator())->getAccount().getUsername() != "Bulk loaded, moved in")
+        return false;
+    if (dtree.retrieve(accounts[1].getDiscriminator())->getAccount().getStatus() != "first")
+        return false;
+    if (dtree.retrieve(accounts[0].getDiscriminator())->getAccount().getStatus() != "again")
+        return false;
+
+    return checkBalanced(dtree, dtree._root);
+}
+
+//BST ordering, correct counts and no imbalance anywhere in the subtree
+bool Tester::checkBalanced(DTree &dtree, DNode *node) {
+    if (!node)
+        return true;
+
+    int size = 1;
+    int numVacant = node->isVacant() ? 1 : 0;
+    if (node->_left) {
+        if (node->_left->getDiscriminator() >= node->getDiscriminator())
+            return false;
+        size += node->_left->getSize();
+        numVacant += node->_left->getNumVacant();
+    }
+    if (node->_right) {
+        if (node->_right->getDiscriminator() <= node->getDiscriminator())
+            return false;
+        size += node->_right->getSize();
+        numVacant += node->_right->getNumVacant();
+    }
+    if (size != node->getSize() || numVacant != node->getNumVacant() || dtree.checkImbalance(node))
+        return false;
+
+    return checkBalanced(dtree, node->_left) && checkBalanced(dtree, node->_right);
+}
+
+bool Tester::testInsertRemoveChurn(DTree &dtree) {
+    std::uniform_int_distribution<> distSmall(0, 299);
+    bool inserted[300] = {false};
+    DNode* removed;
+
+    for (int i = 0; i < 5000; i++) {
+        int disc = distSmall(rng);
+        if (i % 3 == 2) {
+            if (dtree.remove(disc, removed) != inserted[disc])
+                return false;
+            inserted[disc] = false;
+        }
+        else {
+            if (dtree.insert(Account("Churn", disc, 0, "", "")) == inserted[disc])
+                return false;
+            inserted[disc] = true;
+            if (!checkBalanced(dtree, dtree._root))
+                return false;
+        }
+    }
+
+    for (int disc = 0; disc < 300; disc++) {
+        if (inserted[disc] != (dtree.retrieve(disc) != nullptr))
+            return false;
+    }
+    return true;
+}
+
+bool Tester::testCompaction(DTree &dtree) {
+    DNode* removed;
+    for (int i = 0; i < 100; i++) {
+        Account acct = Account("Compact", i, 0, "", "");
+        dtree.insert(acct);
+    }
+    for (int i = 0; i < 60; i++)
+        dtree.remove(i, removed);
+
+    //maintenance pass hands back every vacant node
+    if (!dtree.needsCompaction() || dtree.compact() != 60 * (sizeof(DNode) + sizeof(Account)))
+        return false;
+    if (dtree._root->getNumVacant() != 0 || dtree._root->getSize() != 40 || !checkBalanced(dtree, dtree._root))
+        return false;
+    if (dtree.compact() != 0 || dtree.retrieve(59) || !dtree.retrieve(60))
+        return false;
+
+    //inline, the vacant share never gets far past the ratio
+    dtree.setCompaction(0.25, true);
+    for (int i = 60; i < 95; i++) {
+        dtree.remove(i, removed);
+        if (removed->getDiscriminator() != i)
+            return false;
+        if (dtree._root->getNumVacant() > 0.25 * dtree._root->getSize() + 1)
+            return false;
+    }
+    return dtree.getNumUsers() == 5 && dtree.retrieve(99) && checkBalanced(dtree, dtree._root);
+}
+
+bool Tester::testRebalanceModes(DTree &inPlace, DTree &array) {
+    inPlace.setRebalanceMode(REBALANCE_IN_PLACE);
+    array.setRebalanceMode(REBALANCE_ARRAY);
+    std::uniform_int_distribution<> distSmall(0, 999);
+    DNode* removed;
+
+    //both modes should rebuild to exactly the same tree
+    for (int i = 0; i < 3000; i++) {
+        int disc = distSmall(rng);
+        if (i % 4 == 3) {
+            inPlace.remove(disc, removed);
+            array.remove(disc, removed);
+        }
+        else {
+            inPlace.insert(Account("Modes", disc, 0, "", ""));
+            array.insert(Account("Modes", disc, 0, "", ""));
+        }
+    }
+    if (!sameShape(inPlace._root, array._root) || !checkBalanced(inPlace, inPlace._root))
+        return false;
+
+    inPlace.compact();
+    array.compact();
+    return sameShape(inPlace._root, array._root) && checkBalanced(inPlace, inPlace._root);
+}
+
+bool Tester::sameShape(DNode *lhs, DNode *rhs) {
+    if (!lhs || !rhs)
+        return lhs == rhs;
+
+    if (lhs->getDiscriminator() != rhs->getDiscriminator() || lhs->isVacant() != rhs->isVacant() ||
+        lhs->getSize() != rhs->getSize() || lhs->getNumVacant() != rhs->getNumVacant())
+        return false;
+
+    return sameShape(lhs->_left, rhs->_left) && sameShape(lhs->_right, rhs->_right);
+}
+
+bool Tester::testOrderStatistics(DTree &dtree) {
+    std::uniform_int_distribution<> distSmall(0, 499);
+    bool inserted[500] = {false};
+    DNode* removed;
+    for (int i = 0; i < 600; i++) {
+        int disc = distSmall(rng);
+        if (i % 5 == 4) {
+            dtree.remove(disc, removed);
+            inserted[disc] = false;
+        }
+        else {
+            dtree.insert(Account("Stats", disc, 0, "", ""));
+            inserted[disc] = true;
+        }
+    }
+
+    //walk the discs in order, comparing against a running count
+    int count = 0;
+    for (int disc = 0; disc < 500; disc++) {
+        if (dtree.rank(disc) != count)
+            return false;
+        if (inserted[disc]) {
+            DNode* node = dtree.select(count);
+            if (!node || node->getDiscriminator() != disc)
+                return false;
+            count++;
+        }
+    }
+    if (dtree.select(count) || dtree.select(-1) || dtree.getNumUsers() != count)
+        return false;
+    if (dtree.countRange(0, 499) != count || dtree.countRange(250, 249) != 0)
+        return false;
+
+    int inRange = 0;
+    for (int disc = 100; disc <= 200; disc++)
+        inRange += inserted[disc];
+    if (dtree.countRange(100, 200) != inRange)
+        return false;
+
+    int lowest = 0;
+    while (inserted[lowest])
+        lowest++;
+    return dtree.lowestFreeDisc() == lowest;
+}
+
+bool Tester::testLowestFreeDisc(UTree &utree) {
+    if (utree.lowestFreeDisc("Signup") != MIN_DISC)
+        return false;
+
+    //hand out discs the way a signup would
+    for (int i = 0; i < 50; i++) {
+        int disc = utree.lowestFreeDisc("Signup");
+        if (disc != i || !utree.insert(Account("Signup", disc, 0, "", "")))
+            return false;
+    }
+
+    //removed discs are handed out again, lowest first
+    DNode* removed;
+    utree.removeUser("Signup", 30, removed);
+    utree.removeUser("Signup", 7, removed);
+    if (utree.lowestFreeDisc("Signup") != 7)
+        return false;
+    utree.insert(Account("Signup", 7, 0, "", ""));
+    if (utree.lowestFreeDisc("Signup") != 30)
+        return false;
+    utree.insert(Account("Signup", 30, 0, "", ""));
+    return utree.lowestFreeDisc("Signup") == 50;
+}
+
+bool Tester::testRangeScan(DTree &dtree) {
+    bool inserted[1000] = {false};
+    DNode* removed;
+    for (int i = 0; i < 1000; i += 3) {
+        dtree.insert(Account("Scan", i, 0, "", ""));
+        inserted[i] = true;
+    }
+    //leave a fully vacant stretch as well as scattered vacancies
+    for (int i = 300; i < 600; i += 3) {
+        dtree.remove(i, removed);
+        inserted[i] = false;
+    }
+    for (int i = 0; i < 1000; i += 21) {
+        dtree.remove(i, removed);
+        inserted[i] = false;
+    }
+
+    int ranges[][2] = {{0, 999}, {1, 2}, {250, 650}, {301, 599}, {700, 700}, {699, 699}, {900, 50}, {-10, 5000}};
+    for (int r = 0; r < 8; r++) {
+        int lo = ranges[r][0];
+        int hi = ranges[r][1];
+        int expected = lo < 0 ? 0 : lo;
+
+        DRangeIterator it = dtree.scan(lo, hi);
+        while (it.hasNext()) {
+            const Account& acct = it.next();
+            //the next valid disc in range has to come out, and nothing in between
+            while (expected <= hi && expected < 1000 && !inserted[expected])
+                expected++;
+            if (acct.getDiscriminator() != expected)
+                return false;
+            expected++;
+        }
+        while (expected <= hi && expected < 1000 && !inserted[expected])
+            expected++;
+        if (expected <= hi && expected < 1000)
+            return false;
+    }
+    return true;
+}
+
+bool Tester::testMoveSemantics(DTree &dtree) {
+    for (int i = 0; i < 100; i++)
+        dtree.emplace("Mover", i * 7, i % 2, "", "moved in place");
+    DNode* root = dtree._root;
+
+    //moving hands over the same nodes and leaves the source empty
+    DTree moved(std::move(dtree));
+    if (dtree._root || moved._root != root || moved.getNumUsers() != 100 || dtree.retrieve(7))
+        return false;
+
+    DTree assigned;
+    assigned.emplace("Mover", 1, 0, "", "");
+    assigned = std::move(moved);
+    if (moved._root || assigned._root != root || !assigned.retrieve(693) || assigned.retrieve(1))
+        return false;
+
+    //copying still makes a deep copy
+    DTree copied(assigned);
+    if (!overload(copied._root, assigned._root) || copied.getNumUsers() != 100)
+        return false;
+
+    //the moved-from tree is still usable
+    return dtree.emplace("Mover", 5, 0, "", "") && dtree.retrieve(5) && dtree.getNumUsers() == 1;
+}
+
 bool Tester::testBasicUTreeInsert(UTree& utree) {
     string dataFile = "accounts.csv";
    
@@ -302,7 +724,7 @@ bool Tester::balanceUTree(UNode* balanceNode) {
     if (balanceNode->_left)
         isBalanced = balanceUTree(balanceNode->_left);
     if (balanceNode->_right)
-        isBalanced = balanceUTree(balanceNode->_left);
+        isBalanced = isBalanced && balanceUTree(balanceNode->_right);
 
     return isBalanced;
 }
@@ -326,112 +748,1247 @@ bool Tester::testUTreeBST(UTree &utree) {
             return true;
     }
 
-    return false;
-}
+    return false;
+}
+
+bool Tester::checkUTreeBST(UNode *node) {
+    if (node->_right && node->_left && node->_left->getUsername() < node->getUsername() &&
+        node->_left->getUsername() < node->_right->getUsername()) {
+        //making sure the tree is balanced
+        checkUTreeBST(node->_left);
+        checkUTreeBST(node->_right);
+        return true;
+    }
+    else
+        return false;
+}
+
+bool Tester::testUTreeRemoveRoot(UTree& utree){
+  DNode* remove;
+
+  Account newAcct = Account("Aqua",3922,1,"Subscriber","");
+  utree.insert(newAcct);
+
+  //remove the root and it's a leaf
+  utree.removeUser("Aqua",3922, remove);
+  if (utree.retrieve("Aqua"))
+    return false;
+  return true;
+}
+
+bool Tester::testUTreeRemoval(UTree& utree) {
+  Account newAcct = Account("Aqua5Seemly",3922,1,"Subscriber","");
+  utree.insert(newAcct);
+  Account new1Acct = Account("Brackle",9550,0,"","This is a status");
+  utree.insert(new1Acct);
+  Account new2Acct = Account("Capstan",4962,1,"Subscriber","proj2 :100:");
+  utree.insert(new2Acct);
+  Account new3Acct = Account("Capstan",7383,1,"","");
+  utree.insert(new3Acct);
+  Account new4Acct = Account("Cinnamon",5319,0,"Subscriber","");
+  utree.insert(new4Acct);
+  Account new5Acct = Account("Capstan",604,0,"","recursion(recursion(recursion()))");
+  utree.insert(new5Acct);
+  Account new6Acct = Account("Cinnamon",1180,0,"HypeSquad Brilliance","");
+  utree.insert(new6Acct);
+  Account new7Acct = Account("Pika",6130,0,"","");
+  utree.insert(new7Acct);
+  Account new8Acct = Account("Brackle",2725,0,"HypeSquad Brilliance","");
+  utree.insert(new8Acct);
+  Account new9Acct = Account("Aqua5Seemly",7300,0,"","");
+  utree.insert(new9Acct);
+  Account new10Acct = Account("Sulkyreal",8550,0,"Subscriber","");
+  utree.insert(new10Acct);
+  Account new11Acct = Account("A",7300,0,"","");
+  utree.insert(new11Acct);
+
+  DNode* removedNode;
+  //remove username with a left and right node and a left grandchild
+  utree.removeUser("Brackle", 9550, removedNode);
+  utree.removeUser("Brackle", 2725, removedNode);
+  
+  if (utree.retrieve("Brackle"))
+    return false;
+  
+  //remove username with a left and right node
+  utree.removeUser("Aqua5Seemly", 7300, removedNode);
+  utree.removeUser("Aqua5Seemly", 3922, removedNode);
+
+  //tests retrieve
+  if (utree.retrieve("Aqua5Seemly"))
+    return false;
+  
+  //remove username with a right and no left node
+  utree.removeUser("A", 7300, removedNode);
+
+  //tests retrieve
+  if (utree.retrieve("A"))
+    return false;
+
+  //remove username leaf
+  utree.removeUser("Capstan",4962, removedNode);
+  utree.removeUser("Capstan",7383,removedNode);
+  utree.removeUser( "Capstan",604,removedNode);
+
+  //tests retrieve
+  if (utree.retrieve("Capstan"))
+    return false;
+
+  //make sure tree is balanced
+  if (utree.checkImbalance(utree._root))
+    return false;
+
+  //remove root node, two right traversals to get to nodeX
+  Account new12Acct = Account("D",7300,0,"","");
+  utree.insert(new12Acct);
+  Account new13Acct = Account("Q",7300,0,"","");
+  utree.insert(new13Acct);
+  Account new14Acct = Account("E",7300,0,"","");
+  utree.insert(new14Acct);
+  Account new15Acct = Account("F",7300,0,"","");
+  utree.insert(new15Acct);
+  utree.removeUser( "Pika",6130,removedNode);
+
+  //tests retrieve
+  if (utree.retrieve("Pika"))
+    return false;
+  
+  return true;
+}
+
+bool Tester::testUTreeReload(UTree& utree) {
+    utree.loadData("accounts.csv");
+    int numDNodes = utree._dnodes->getNumLive();
+    int numUNodes = utree._unodes.getNumLive();
+    if (numDNodes == 0 || numUNodes == 0)
+        return false;
+
+    //reloading without append should land on the same node counts
+    utree.loadData("accounts.csv", false);
+    if (utree._dnodes->getNumLive() != numDNodes || utree._unodes.getNumLive() != numUNodes)
+        return false;
+    if (!utree.retrieveUser("Brackle", 9550))
+        return false;
+
+    //removing a whole username hands its nodes back to the pools
+    DNode* removed;
+    utree.removeUser("Pika", 6130, removed);
+    if (utree.numUsers("Pika") == 0 && utree._unodes.getNumLive() != numUNodes - 1)
+        return false;
+
+    utree.clear();
+    if (utree._dnodes->getNumLive() != 0 || utree._unodes.getNumLive() != 0 || utree.retrieve("Brackle"))
+        return false;
+
+    //tree should be usable again after clearing
+    Account acct = Account("Brackle", 9550, 0, "", "");
+    return utree.insert(acct) && utree.retrieveUser("Brackle", 9550);
+}
+
+bool Tester::testUTreeCompaction(UTree& utree) {
+    utree.loadData("accounts.csv");
+    DNode* removed;
+
+    //nothing to do until there are vacant nodes
+    if (utree.compact(true) != 0)
+        return false;
+
+    utree.removeUser("Brackle", 9550, removed);
+    utree.removeUser("Kippage", 9918, removed);
+    int numLive = utree._dnodes->getNumLive();
+
+    //one removal is under the default ratio for both users
+    if (utree.compact() != 0)
+        return false;
+    if (utree.compact(true) != 2 * (sizeof(DNode) + sizeof(Account)) || utree._dnodes->getNumLive() != numLive - 2)
+        return false;
+
+    //new users pick up the policy too
+    utree.setCompaction(0.0, true);
+    Account acct = Account("Compacted", 1, 0, "", "");
+    utree.insert(acct);
+    acct = Account("Compacted", 2, 0, "", "");
+    utree.insert(acct);
+    utree.removeUser("Compacted", 1, removed);
+    utree.removeUser("Compacted", 2, removed);
+    return utree.retrieveUser("Compacted", 2) == nullptr && !utree.retrieveUser("Brackle", 9550);
+}
+
+bool Tester::testOccupancyBitmap(UTree &utree) {
+    DNode* removed;
+    bool inserted[NUM_DISC] = {false};
+
+    //fill a prefix completely so firstFree has to skip whole vectors
+    for (int disc = 0; disc < 700; disc++) {
+        utree.insert(Account("Bits", disc, 0, "", ""));
+        inserted[disc] = true;
+    }
+    for (int i = 0; i < 300; i++) {
+        int disc = RANDDISC;
+        if (utree.insert(Account("Bits", disc, 0, "", "")) == inserted[disc])
+            return false;
+        inserted[disc] = true;
+    }
+    utree.removeUser("Bits", 9999, removed);
+    inserted[9999] = false;
+
+    const DiscBitmap* bits = utree.retrieve("Bits")->getDTree()->getOccupancy();
+    if (bits->count() != utree.numUsers("Bits") || bits->firstFree() != 700)
+        return false;
+
+    //batch lookups, including discs out of range and a tail past a multiple of 8
+    int discs[NUM_DISC + 3];
+    bool found[NUM_DISC + 3];
+    for (int disc = 0; disc < NUM_DISC; disc++)
+        discs[disc] = disc;
+    discs[NUM_DISC] = -1;
+    discs[NUM_DISC + 1] = MAX_DISC + 1;
+    discs[NUM_DISC + 2] = 650;
+    if (utree.contains("Bits", discs, NUM_DISC + 3, found) != utree.numUsers("Bits") + 1)
+        return false;
+    for (int disc = 0; disc < NUM_DISC; disc++) {
+        if (found[disc] != inserted[disc] || utree.contains("Bits", disc) != inserted[disc])
+            return false;
+    }
+    if (found[NUM_DISC] || found[NUM_DISC + 1] || !found[NUM_DISC + 2])
+        return false;
+
+    //a full bitmap has nothing free, unknown users have nothing at all
+    for (int disc = 0; disc < NUM_DISC; disc++)
+        utree.insert(Account("Bits", disc, 0, "", ""));
+    if (bits->firstFree() != INVALID_DISC || bits->count() != NUM_DISC)
+        return false;
+    return utree.contains("Nobody", discs, 10, found) == 0 && !utree.contains("Nobody", 1);
+}
+
+bool Tester::testMoveInsert(UTree &utree) {
+    //strings too long for the small string buffer, so a copy would show up as a new buffer
+    Account acct = Account("MoveInsertUsername", 42, 1, "Subscriber badge text", "a status that is long enough");
+    const char* username = acct.getUsername().data();
+    if (!utree.insert(std::move(acct)))
+        return false;
+    DNode* node = utree.retrieveUser("MoveInsertUsername", 42);
+    if (!node || node->_account->getUsername().data() != username)
+        return false;
+
+    //lvalues are still copied
+    Account kept = Account("MoveInsertUsername", 43, 0, "", "a status that is long enough");
+    if (!utree.insert(kept) || kept.getStatus() != "a status that is long enough")
+        return false;
+
+    if (!utree.emplace("Another", 1, 0, "", "") || utree.emplace("Another", 1, 0, "", ""))
+        return false;
+
+    //removing a username moves the DTrees around instead of copying them
+    utree.emplace("Middle", 1, 0, "", "");
+    utree.emplace("Zed", 1, 0, "", "");
+    DNode* removed;
+    DNode* zed = utree.retrieveUser("Zed", 1);
+    utree.removeUser("MoveInsertUsername", 42, removed);
+    utree.removeUser("MoveInsertUsername", 43, removed);
+    utree.removeUser("Another", 1, removed);
+    return utree.retrieveUser("Zed", 1) == zed && utree.retrieveUser("Middle", 1) && !utree.retrieve("Another");
+}
+
+bool Tester::testSnapshots(DTree &dtree) {
+    //past the dense threshold, so the table has to follow the copied nodes
+    for (int i = 0; i < 600; i++)
+        dtree.emplace("Snapper", i * 3, 0, "", "");
+    DTree snap = dtree.snapshot();
+    if (snap._root != dtree._root || snap.getNumUsers() != 600 || !snap.contains(300))
+        return false;
+
+    //writes on either side copy only their path, the other version stays as it was
+    DNode* removed;
+    for (int i = 0; i < 200; i++)
+        dtree.remove(i * 3, removed);
+    for (int i = 0; i < 300; i++)
+        dtree.emplace("Snapper", i * 3 + 1, 0, "", "");
+    snap.emplace("Snapper", 2, 0, "", "");
+    if (dtree.getNumUsers() != 700 || snap.getNumUsers() != 601 || dtree.retrieve(2) || dtree.contains(2))
+        return false;
+
+    for (int i = 0; i < 600; i++) {
+        DNode* node = snap.retrieve(i * 3);
+        DNode* current = dtree.retrieve(i * 3);
+        if (!node || node->getDiscriminator() != i * 3 || (i < 200) != (current == nullptr))
+            return false;
+    }
+    for (int i = 0; i < 300; i++) {
+        DNode* node = dtree.retrieve(i * 3 + 1);
+        if (!node || node->getDiscriminator() != i * 3 + 1 || snap.retrieve(i * 3 + 1))
+            return false;
+    }
+    if (!checkBalanced(dtree, dtree._root) || !checkBalanced(snap, snap._root))
+        return false;
+
+    //compacting takes every node back, after that nothing is shared
+    dtree.remove(1, removed);
+    dtree.compact();
+    if (dtree._shared || dtree.getNumUsers() != 699 || snap.getNumUsers() != 601)
+        return false;
+
+    //the tree outlives its snapshot and the other way around
+    DTree* later = new DTree(dtree.snapshot());
+    dtree.clear();
+    bool kept = later->getNumUsers() == 699 && later->retrieve(4) && later->retrieve(600);
+    delete later;
+    if (!kept || !snap.retrieve(2) || snap.getNumUsers() != 601)
+        return false;
+
+    //vacant nodes a snapshot still holds free nothing, so compact() doesn't count them
+    DTree holder;
+    for (int i = 0; i < 100; i++)
+        holder.emplace("Holder", i, 0, "", "");
+    for (int i = 0; i < 40; i++)
+        holder.remove(i, removed);
+    DTree held = holder.snapshot();
+    holder.remove(99, removed);
+    int numLive = holder._pool->getNumLive();
+    size_t reclaimed = holder.compact();
+    return reclaimed == sizeof(DNode) + sizeof(Account) && holder._pool->getNumLive() >= numLive &&
+           holder.getNumUsers() == 59 && held.getNumUsers() == 60;
+}
+
+bool Tester::testUTreeSnapshot(UTree &utree) {
+    for (int i = 0; i < 50; i++) {
+        utree.emplace("Reported", i, 0, "", "");
+        utree.emplace("Other", i, 0, "", "");
+    }
+    DTree report = utree.snapshot("Reported");
+    if (report.getNumUsers() != 50 || utree.snapshot("Missing")._root)
+        return false;
+
+    DNode* removed;
+    utree.removeUser("Reported", 10, removed);
+    utree.emplace("Reported", 99, 0, "", "");
+    if (!report.retrieve(10) || report.retrieve(99))
+        return false;
+
+    //clearing the UTree leaves the snapshot's nodes alone
+    utree.clear();
+    if (report.getNumUsers() != 50 || !report.retrieve(49))
+        return false;
+    return utree.emplace("Reported", 1, 0, "", "") && utree.numUsers("Reported") == 1;
+}
+
+bool Tester::testInternedAccounts() {
+    //one string per distinct badge or status, ids in the account
+    if (sizeof(Account) > sizeof(string) + 16)
+        return false;
+
+    uint32_t baseline = StringDict::global().size();
+    Account first = Account("Interned", 1, 1, "Subscriber", "a status shared by many accounts");
+    uint32_t numStrings = StringDict::global().size();
+    Account second = Account("Interned", 2, 0, "Subscriber", "a status shared by many accounts");
+    if (StringDict::global().size() != numStrings || &first.getStatus() != &second.getStatus() ||
+        first._badge != second._badge)
+        return false;
+
+    if (!first.hasNitro() || second.hasNitro() || second.getBadge() != "Subscriber" ||
+        second.getStatus() != "a status shared by many accounts")
+        return false;
+
+    //a string goes once the last account holding it does, copies included
+    {
+        Account unique = Account("Interned", 3, 0, "Subscriber", "a status nobody else has");
+        Account copy = unique;
+        Account moved = std::move(unique);
+        if (StringDict::global().size() != numStrings + 1 || unique._status != 0 || copy.getStatus() != moved.getStatus())
+            return false;
+        copy = second;
+        if (StringDict::global().size() != numStrings + 1 || copy.getStatus() != "a status shared by many accounts")
+            return false;
+    }
+    if (StringDict::global().size() != numStrings)
+        return false;
+
+    //clearing a tree gives its strings back
+    {
+        UTree utree;
+        for (int i = 0; i < 100; i++)
+            utree.emplace("Interned", i, 0, "Subscriber", "status " + std::to_string(i));
+        if (StringDict::global().size() != numStrings + 100 || utree.retrieveUser("Interned", 42)->getAccount().getStatus() != "status 42")
+            return false;
+        utree.clear();
+        if (StringDict::global().size() != numStrings)
+            return false;
+    }
+
+    //ids keep working across the growing chunks, and freed ones are handed out again
+    StringDict dict;
+    for (int i = 1; i < 8 * DICT_CHUNK_SIZE; i++) {
+        if (dict.intern(std::to_string(i)) != (uint32_t)i)
+            return false;
+    }
+    for (int i = 1; i < 8 * DICT_CHUNK_SIZE; i++) {
+        if (dict.lookup(i) != std::to_string(i) || dict.intern(std::to_string(i)) != (uint32_t)i)
+            return false;
+        dict.release(i);
+    }
+    dict.release(1234);
+    if (dict.size() != 8 * DICT_CHUNK_SIZE - 1 || dict.intern("new") != 1234 || dict.lookup(1234) != "new" || dict.lookup(0) != "")
+        return false;
+
+    //empty strings never reach the dictionary
+    Account empty;
+    Account blank = Account("Interned", 3, 0, "", "");
+    return empty.getBadge() == "" && empty.getStatus() == "" && blank._badge == 0 && blank._status == 0 &&
+           StringDict::global().size() == numStrings && numStrings <= baseline + 2;
+}
+
+bool Tester::testNodePayloads(DTree &dtree) {
+    //the search node holds no strings, only keys, counts and links
+    if (sizeof(DNode) > 5 * sizeof(void*))
+        return false;
+
+    //a node outside any tree still answers with a default account
+    DNode loose;
+    if (loose.getAccount().getDiscriminator() != INVALID_DISC || loose.getUsername() != DEFAULT_USERNAME ||
+        loose.getDiscriminator() != INVALID_DISC)
+        return false;
+
+    DNode* removed;
+    for (int i = 0; i < 200; i++)
+        dtree.emplace("Payload", i * 2, 0, "", "");
+    for (int i = 0; i < 200; i += 3)
+        dtree.remove(i * 2, removed);
+    //refilling vacant nodes reuses their payload
+    for (int i = 0; i < 400; i += 5)
+        dtree.emplace("Refill", i, 1, "", "");
+
+    DNode* node = dtree.retrieve(5);
+    if (!node || node->getAccount().getUsername() != "Refill" || !node->getAccount().hasNitro())
+        return false;
+    return checkPayloads(dtree._root);
+}
+
+//every node's key matches the account it points at
+bool Tester::checkPayloads(DNode *node) {
+    if (!node)
+        return true;
+    if (!node->_account || node->_disc != node->_account->_disc)
+        return false;
+    return checkPayloads(node->_left) && checkPayloads(node->_right);
+}
+
+bool Tester::testBTree(DBTree &btree) {
+    //thousands of discs stay within three levels
+    for (int i = 0; i < 5000; i++) {
+        if (!btree.insert(Account("Wide", (i * 7919) % 10000, i % 2, "", "")))
+            return false;
+    }
+    if (btree.getNumUsers() != 5000 || btree.getHeight() > 3 || btree.insert(Account("Wide", 7919, 0, "", "")))
+        return false;
+
+    //keys stay sorted and padded
+    BNode* leaf = btree._root;
+    while (!leaf->_leaf)
+        leaf = leaf->_children[0];
+    for (int i = 1; i < BNODE_KEYS; i++) {
+        if (i < leaf->_count ? leaf->_keys[i] <= leaf->_keys[i - 1] : leaf->_keys[i] != BNODE_PAD)
+            return false;
+    }
+
+    //removing most of them merges nodes back down
+    DNode* removed;
+    for (int i = 0; i < 4900; i++) {
+        int disc = (i * 7919) % 10000;
+        if (!btree.remove(disc, removed) || removed->getDiscriminator() != disc || btree.retrieve(disc))
+            return false;
+    }
+    if (btree.remove(7919, removed) || btree.getNumUsers() != 100 || btree.getHeight() > 2)
+        return false;
+
+    for (int i = 4900; i < 5000; i++) {
+        DNode* node = btree.retrieve((i * 7919) % 10000);
+        if (!node || node->getDiscriminator() != (i * 7919) % 10000 || node->getAccount().hasNitro() != (i % 2))
+            return false;
+    }
+    if (btree.retrieve(-1) || btree.retrieve(MAX_DISC + 1))
+        return false;
+
+    //the same DTree-style code runs against either tree and sees the same results
+    DTree dtree;
+    DBTree other;
+    std::vector<int> expected, trace;
+    runDiscWorkload(dtree, expected);
+    runDiscWorkload(other, trace);
+    return trace == expected && expected.size() > 3000;
+}
+
+//inserts, lookups and removals through the interface DTree and DBTree share,
+//recording every result
+template <class T>
+void Tester::runDiscWorkload(T &tree, std::vector<int> &trace) {
+    for (int i = 0; i < 1500; i++) {
+        int disc = (i * 4099) % 3000;
+        trace.push_back(tree.insert(Account("Workload", disc, disc % 3 == 0, "", "")));
+    }
+    DNode* removed;
+    for (int i = 0; i < 3000; i += 2) {
+        bool found = tree.remove(i, removed);
+        trace.push_back(found);
+        //the removed node is still readable until the next write
+        if (found)
+            trace.push_back(removed->getDiscriminator() * 2 + removed->getAccount().hasNitro());
+        trace.push_back(tree.contains(i));
+    }
+    for (int i = 0; i < 3000; i += 3) {
+        DNode* node = tree.retrieve(i);
+        trace.push_back(node ? node->getDiscriminator() : INVALID_DISC);
+    }
+    trace.push_back(tree.insert(Account("Workload", 2, false, "", "")));
+    trace.push_back(tree.getNumUsers());
+}
+
+bool Tester::testConcurrentUTree(UTree &utree) {
+    const int numWriters = 8;
+    utree.setConcurrent(true);
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+
+    //each writer has usernames of its own and a slice of one shared username
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numWriters; t++) {
+        threads.emplace_back([&utree, &errors, t]() {
+            for (int k = 0; k < 20; k++) {
+                string username = "Writer" + std::to_string(t) + "_" + std::to_string(k);
+                for (int disc = 0; disc < 30; disc++) {
+                    if (!utree.emplace(username, disc, 0, "", ""))
+                        errors++;
+                }
+                if (!utree.emplace("Shared", t * 100 + k, 0, "", "") || utree.emplace("Shared", t * 100 + k, 0, "", ""))
+                    errors++;
+            }
+
+            //drop every account of half the usernames, UNodes go with them
+            DNode* removed;
+            for (int k = 0; k < 20; k += 2) {
+                string username = "Writer" + std::to_string(t) + "_" + std::to_string(k);
+                for (int disc = 0; disc < 30; disc++) {
+                    if (!utree.removeUser(username, disc, removed))
+                        errors++;
+                }
+            }
+        });
+    }
+
+    //readers only ever see whole accounts
+    for (int r = 0; r < 2; r++) {
+        threads.emplace_back([&utree, &errors, &done, r]() {
+            Account found;
+            while (!done) {
+                for (int t = 0; t < numWriters; t++) {
+                    string username = "Writer" + std::to_string(t) + "_" + std::to_string(r);
+                    if (utree.findUser(username, 7, found) &&
+                        (found.getUsername() != username || found.getDiscriminator() != 7))
+                        errors++;
+                    if (utree.numUsers(username) > 30 || utree.numUsers("Shared") > numWriters * 20)
+                        errors++;
+                }
+            }
+        });
+    }
+
+    for (int t = 0; t < numWriters; t++)
+        threads[t].join();
+    done = true;
+    for (unsigned int t = numWriters; t < threads.size(); t++)
+        threads[t].join();
+
+    if (errors != 0 || utree.numUsers("Shared") != numWriters * 20 || !testUTreeBalance(utree))
+        return false;
+    for (int t = 0; t < numWriters; t++) {
+        for (int k = 0; k < 20; k++) {
+            string username = "Writer" + std::to_string(t) + "_" + std::to_string(k);
+            if (utree.numUsers(username) != (k % 2 ? 30 : 0) || utree.contains(username, 29) != (k % 2 == 1))
+                return false;
+        }
+    }
+
+    UNode* shared = utree.retrieve("Shared");
+    return checkBalanced(*shared->getDTree(), shared->getDTree()->_root);
+}
+
+//heights are right, every node is balanced and keys are in order
+bool Tester::checkUTreeAVL(UNode *node, int &height) {
+    height = -1;
+    if (!node)
+        return true;
+
+    int left, right;
+    if (!checkUTreeAVL(node->_left, left) || !checkUTreeAVL(node->_right, right))
+        return false;
+    if ((node->_left && node->_left->_username >= node->_username) ||
+        (node->_right && node->_right->_username <= node->_username))
+        return false;
+
+    height = std::max(left, right) + 1;
+    return node->_height == height && abs(left - right) <= 1;
+}
+
+bool Tester::testLockFreeReads(UTree &utree) {
+    const int numStable = 16;
+    const int numChurn = 200;
+
+    //accounts nobody removes, every read has to find them at all times
+    for (int k = 0; k < numStable; k++) {
+        for (int disc = 0; disc < 50; disc++)
+            utree.emplace("Stable" + std::to_string(k), disc, 0, "", "");
+    }
+    utree.setCompaction(0.2, true);
+    utree.setLockFreeReads(true);
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+
+    //new usernames rotate the AVL tree, churn on the stable ones rebuilds their DTrees
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&utree, &errors, t]() {
+            DNode* removed;
+            for (int k = 0; k < numChurn; k++) {
+                string username = "Churn" + std::to_string(t) + "_" + std::to_string(k);
+                string stable = "Stable" + std::to_string(k % numStable);
+                int base = 1000 + t * 4000 + k * 10;
+                for (int disc = 0; disc < 10; disc++) {
+                    if (!utree.emplace(username, disc, 0, "", "") || !utree.emplace(stable, base + disc, 0, "", ""))
+                        errors++;
+                }
+                for (int disc = 0; disc < 10; disc++) {
+                    if ((k % 2 && !utree.removeUser(username, disc, removed)) || !utree.removeUser(stable, base + disc, removed))
+                        errors++;
+                }
+            }
+        });
+    }
+
+    for (int r = 0; r < 4; r++) {
+        threads.emplace_back([&utree, &errors, &done, r]() {
+            for (int i = r; !done; i++) {
+                string stable = "Stable" + std::to_string(i % numStable);
+                int disc = i % 50;
+                {
+                    EpochGuard guard;
+                    DNode* node = utree.retrieveUser(stable, disc);
+                    if (!node || node->getDiscriminator() != disc || node->getUsername() != stable)
+                        errors++;
+                }
+                if (utree.numUsers(stable) < 50 || utree.numUsers("Churn0_" + std::to_string(i % numChurn)) > 10)
+                    errors++;
+            }
+        });
+    }
+
+    for (int t = 0; t < 2; t++)
+        threads[t].join();
+    done = true;
+    for (unsigned int t = 2; t < threads.size(); t++)
+        threads[t].join();
+
+    //turning the mode off frees what's retired and drops the emptied UNodes
+    utree.setLockFreeReads(false);
+    int height;
+    if (errors != 0 || !utree._retiredUNodes.empty() || !utree._retiredViews.empty())
+        return false;
+    if (utree._unodes.getNumLive() != numStable + numChurn || !testUTreeBalance(utree) || !checkUTreeAVL(utree._root, height))
+        return false;
+    for (int k = 0; k < numStable; k++) {
+        if (utree.numUsers("Stable" + std::to_string(k)) != 50)
+            return false;
+    }
+    for (int k = 0; k < numChurn; k++) {
+        string username = "Churn1_" + std::to_string(k);
+        if (utree.numUsers(username) != (k % 2 ? 0 : 10) || (utree.retrieve(username) != nullptr) != (k % 2 == 0))
+            return false;
+    }
+
+    //a DNode from retrieveUser() is only safe under an EpochGuard taken
+    //before the call, which keeps it readable while a writer retires and
+    //reclaims around it
+    UTree guarded;
+    guarded.setLockFreeReads(true);
+    guarded.emplace("Guarded", 1, false, "", "Held");
+    {
+        EpochGuard guard;
+        DNode* node = guarded.retrieveUser("Guarded", 1);
+        std::thread writer([&guarded]() {
+            DNode* removed;
+            guarded.removeUser("Guarded", 1, removed);
+            for (int i = 0; i < 4 * RETIRE_BATCH; i++) {
+                guarded.emplace("Guarded", 2, false, "", "");
+                guarded.removeUser("Guarded", 2, removed);
+            }
+        });
+        writer.join();
+        if (!node || node->getAccount().getStatus() != "Held" || guarded.retrieveUser("Guarded", 1))
+            return false;
+    }
+
+    //one reading thread past MAX_READERS is turned away with length_error,
+    //and the slots come back as the threads exit
+    EpochGuard pinned;
+    std::atomic<int> numArrived(0);
+    std::atomic<int> numRefused(0);
+    threads.clear();
+    for (int t = 0; t < MAX_READERS; t++) {
+        threads.emplace_back([&guarded, &numArrived, &numRefused]() {
+            try {
+                EpochGuard guard;
+                guarded.numUsers("Guarded");
+                numArrived++;
+                while (numArrived + numRefused < MAX_READERS)
+                    std::this_thread::yield();
+            }
+            catch (const std::length_error&) {
+                numRefused++;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    std::thread late([&guarded, &errors]() {
+        if (guarded.numUsers("Guarded") != 0)
+            errors++;
+    });
+    late.join();
+    return numRefused == 1 && errors == 0;
+}
+
+bool Tester::testParallelLoad(UTree &utree) {
+    //every split of the file, down to chunks of a line or less, loads the same tree
+    UTree serial;
+    serial.loadData("accounts.csv");
+    for (int numThreads : {2, 7, 300}) {
+        utree.loadData("accounts.csv", false, numThreads);
+        int height;
+        if (utree._unodes.getNumLive() != serial._unodes.getNumLive() ||
+            utree._dnodes->getNumLive() != serial._dnodes->getNumLive() || !checkUTreeAVL(utree._root, height))
+            return false;
+
+        std::ifstream file("accounts.csv");
+        string username, disc, line;
+        while (std::getline(file, username, ',') && std::getline(file, disc, ',') && std::getline(file, line)) {
+            DNode* node = utree.retrieveUser(username, std::stoi(disc));
+            DNode* expected = serial.retrieveUser(username, std::stoi(disc));
+            if (!node || utree.numUsers(username) != serial.numUsers(username) ||
+                node->getAccount().getStatus() != expected->getAccount().getStatus())
+                return false;
+        }
+    }
+
+    //appending loads nothing twice
+    utree.loadData("accounts.csv", true, 4);
+    if (utree._dnodes->getNumLive() != serial._dnodes->getNumLive())
+        return false;
+
+    //an attached log gets the same records whatever the number of threads
+    for (int numThreads : {1, 4}) {
+        std::remove("load.log");
+        WriteLog log;
+        UTree logged, replayed;
+        log.open("load.log");
+        logged.setLog(&log);
+        logged.loadData("accounts.csv", true, numThreads);
+        logged.loadData("accounts.csv", true, numThreads);
+        logged.setLog(nullptr);
+        log.close();
+        if (log.getNumAppended() != (uint64_t)serial._dnodes->getNumLive() ||
+            replayed.replay("load.log") != serial._dnodes->getNumLive() || replayed._dnodes->getNumLive() != serial._dnodes->getNumLive())
+            return false;
+    }
+    std::remove("load.log");
+
+    //a malformed line anywhere fails the whole load
+    std::ofstream("malformed.csv") << "Fine,1,0,,\nBroken,2,0\nFine,3,0,,\n";
+    try {
+        utree.loadData("malformed.csv", false, 3);
+        return false;
+    } catch (std::invalid_argument& e) {
+    }
+    std::remove("malformed.csv");
+    return utree.numUsers("Fine") == 0;
+}
+
+bool Tester::testMappedLoad(UTree &utree) {
+    //a clean file loads the same tree loadData builds
+    UTree serial;
+    serial.loadData("accounts.csv");
+    LoadReport report;
+    if (!utree.loadMapped("accounts.csv", report) || report._numRows != 200 || !report._errors.empty() ||
+        utree._dnodes->getNumLive() != serial._dnodes->getNumLive() || report._numInserted != serial._dnodes->getNumLive())
+        return false;
+
+    //bad rows are reported and skipped, the rest still goes in; the last line has no newline
+    string longName(100, 'x');
+    std::ofstream("mapped.csv") << "Good,1,0,,\nBad,12x,0,,\nShort,2\n\n" << longName << ",7,1,,\n"
+                                << "Range,10000,0,,\nGood,2,1,Badge,Status";
+    bool clean = utree.loadMapped("mapped.csv", report, false);
+    std::remove("mapped.csv");
+    if (clean || report._numRows != 7 || report._numInserted != 3 || report._errors.size() != 4)
+        return false;
+    if (report._errors[0]._line != 2 || report._errors[0]._row != "Bad,12x,0,," || report._errors[2]._line != 4 ||
+        report._errors[3]._line != 6)
+        return false;
+    DNode* node = utree.retrieveUser("Good", 2);
+    if (utree.numUsers("Good") != 2 || !node || node->getAccount().getStatus() != "Status" ||
+        !utree.retrieveUser(longName, 7) || utree.numUsers("Range") != 0)
+        return false;
+
+    //a missing file is an error in the report, and leaves the tree alone
+    return !utree.loadMapped("missing.csv", report, false) && report._errors.size() == 1 &&
+           report._errors[0]._line == 0 && utree.numUsers("Good") == 2;
+}
+
+bool Tester::testSnapshotFile(UTree &utree) {
+    utree.loadData("accounts.csv");
+    DNode* removed;
+    utree.removeUser("Brackle", 9550, removed);
+    utree.removeUser("Pika", 6130, removed);
+    if (!utree.save("utree.snap"))
+        return false;
+
+    //the reloaded tree and the mapped file both hold exactly the valid accounts
+    UTree loaded;
+    UTreeImage image;
+    int height;
+    if (!loaded.load("utree.snap") || !image.open("utree.snap") || !checkUTreeAVL(loaded._root, height))
+        return false;
+    if (loaded._dnodes->getNumLive() != image.getNumAccounts() || loaded.retrieveUser("Brackle", 9550) ||
+        image.numUsers("Pika") != 24 || loaded.numUsers("Pika") != 24)
+        return false;
+
+    std::ifstream file("accounts.csv");
+    string username, disc, line;
+    Account found;
+    while (std::getline(file, username, ',') && std::getline(file, disc, ',') && std::getline(file, line)) {
+        DNode* node = utree.retrieveUser(username, std::stoi(disc));
+        DNode* copy = loaded.retrieveUser(username, std::stoi(disc));
+        if (!node != !copy || image.findUser(username, std::stoi(disc), found) != (node != nullptr) ||
+            loaded.numUsers(username) != utree.numUsers(username) || image.numUsers(username) != utree.numUsers(username))
+            return false;
+        if (node && (copy->getAccount().getStatus() != node->getAccount().getStatus() ||
+                     found.getBadge() != node->getAccount().getBadge() || found.hasNitro() != node->getAccount().hasNitro()))
+            return false;
+    }
+    size_t firstAccount = sizeof(SnapshotHeader) + image.getNumUsernames() * sizeof(SnapshotUsername);
+    image.close();
+
+    //loads racing a writer leave no UNode outside the tree
+    UTree racing;
+    racing.setConcurrent(true);
+    std::atomic<bool> done(false);
+    std::thread writer([&racing, &done]() {
+        for (int i = 0; !done; i = (i + 1) % 10000)
+            racing.insert(Account("Racer" + std::to_string(i % 50), i, false, "", ""));
+    });
+    for (int i = 0; i < 20; i++)
+        racing.load("utree.snap");
+    done = true;
+    writer.join();
+    std::vector<UNode*> nodes;
+    racing.flatten(racing._root, nodes);
+    if ((int)nodes.size() != racing._unodes.getNumLive())
+        return false;
+
+    //a damaged file is turned down and the tree is left as it was
+    std::ifstream in("utree.snap", std::ios::binary);
+    string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream("utree.snap", std::ios::binary | std::ios::trunc) << bytes.substr(0, bytes.size() - 1);
+    bool truncated = loaded.load("utree.snap");
+    bytes[firstAccount + 1] = 0x7f;     /* disc way past MAX_DISC */
+    std::ofstream("utree.snap", std::ios::binary | std::ios::trunc) << bytes;
+    bool corrupted = loaded.load("utree.snap") || image.open("utree.snap");
+    std::remove("utree.snap");
+    return !truncated && !corrupted && !loaded.load("missing.snap") && loaded.numUsers("Aqua5Seemly") == utree.numUsers("Aqua5Seemly") &&
+           !utree.save("missing/utree.snap");
+}
+
+bool Tester::testWriteLog(UTree &utree) {
+    std::remove("utree.log");
+    WriteLog log;
+    if (!log.open("utree.log"))
+        return false;
+    utree.setLog(&log);
+
+    //only writes that go through are logged
+    DNode* removed;
+    utree.insert(Account("Cosmo", 1001, true, "Gold", "Online"));
+    utree.insert(Account("Cosmo", 1002, false, "", "Away"));
+    utree.insert(Account("Wanda", 3003, false, "Silver", ""));
+    utree.insert(Account("Cosmo", 1001, false, "", ""));
+    utree.removeUser("Cosmo", 1001, removed);
+    utree.removeUser("Cosmo", 4004, removed);
+    utree.insert(Account("Cosmo", 1001, false, "Bronze", ""));
+    utree.removeUser("Wanda", 3003, removed);
+    if (log.getNumAppended() != 6 || !log.commit() || log.getNumDurable() != 6)
+        return false;
+
+    //replay applies them to a fresh tree in order
+    UTree replayed;
+    if (replayed.replay("utree.log") != 6 || replayed.numUsers("Cosmo") != 2 || replayed.numUsers("Wanda") != 0 ||
+        !replayed.retrieveUser("Cosmo", 1001) || replayed.retrieveUser("Cosmo", 1001)->getAccount().getBadge() != "Bronze")
+        return false;
+
+    //threads committing at once share syncs
+    utree.setConcurrent(true);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; t++) {
+        writers.emplace_back([&utree, &log, t]() {
+            for (int i = 0; i < 50; i++) {
+                utree.insert(Account("Writer" + std::to_string(t), MIN_DISC + i, false, "", ""));
+                log.commit();
+            }
+        });
+    }
+    for (std::thread& writer : writers)
+        writer.join();
+    if (log.getNumDurable() != 206 || log.getNumSyncs() >= 206)
+        return false;
+    utree.setLog(nullptr);
+    log.close();
+
+    //a torn record at the end is ignored, then cut off when the log is reopened
+    std::ofstream("utree.log", std::ios::binary | std::ios::app) << WriteLog::insertRecord(Account("Torn", 5, false, "", "")).substr(0, 12);
+    UTree torn;
+    if (torn.replay("utree.log") != 206 || torn.numUsers("Torn") != 0 || torn.numUsers("Writer3") != 50)
+        return false;
+    for (int t = 0; t < 4; t++) {
+        for (int i = 0; i < 50; i++) {
+            if (!torn.retrieveUser("Writer" + std::to_string(t), MIN_DISC + i))
+                return false;
+        }
+    }
+    if (!log.open("utree.log") || log.getNumAppended() != 0)
+        return false;
+    log.close();
+
+    //a damaged record stops replay there
+    std::ifstream in("utree.log", std::ios::binary);
+    string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    bytes[LOG_HEADER + 11] ^= 1;
+    std::ofstream("utree.log", std::ios::binary | std::ios::trunc) << bytes;
+    UTree damaged;
+    int numReplayed = damaged.replay("utree.log");
+    std::remove("utree.log");
+    if (numReplayed != 0 || damaged.numUsers("Cosmo") != 0 || damaged.replay("utree.log") != -1)
+        return false;
+
+    //a truncate waits out a flush in flight, so commits waiting on it return
+    //and nothing from before it is written into the emptied log
+    if (!log.open("utree.log"))
+        return false;
+    string big = WriteLog::insertRecord(Account("Big", 1, false, "", string(4000, 's')));
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < LOG_GROUP_SIZE; i++)
+            log.append(big);
+        log.append(WriteLog::insertRecord(Account("Small", 2, false, "", "")));
+        std::thread committer([&log]() {log.commit();});
+        log.truncate();
+        committer.join();
+        if (log.getNumDurable() != log.getNumAppended())
+            return false;
+    }
+
+    //commits and truncates from several threads at once, durable never going back
+    std::atomic<bool> done(false);
+    bool monotonic = true;
+    std::thread truncater([&]() {
+        uint64_t last = 0;
+        while (!done) {
+            log.truncate();
+            uint64_t durable = log.getNumDurable();
+            monotonic = monotonic && durable >= last;
+            last = durable;
+            std::this_thread::yield();
+        }
+    });
+    writers.clear();
+    for (int t = 0; t < 3; t++) {
+        writers.emplace_back([&log, &big]() {
+            for (int i = 0; i < 100; i++) {
+                log.append(big);
+                log.commit();
+            }
+        });
+    }
+    for (std::thread& writer : writers)
+        writer.join();
+    done = true;
+    truncater.join();
+    bool truncated = log.truncate() && log.getNumDurable() == log.getNumAppended();
+    log.close();
+    numReplayed = damaged.replay("utree.log");
+    std::remove("utree.log");
+    if (!monotonic || !truncated || numReplayed != 0)
+        return false;
+
+    //checkpoints taken while writers run: the snapshot and the log after it
+    //always add up to the whole tree
+    UTree source;
+    source.loadData("accounts.csv");
+    source.setConcurrent(true);
+    if (!log.open("utree.log"))
+        return false;
+    source.setLog(&log);
+    if (!source.checkpoint("utree.snap"))
+        return false;
+    std::atomic<int> numDone(0);
+    writers.clear();
+    for (int t = 0; t < 3; t++) {
+        writers.emplace_back([&source, &numDone, t]() {
+            DNode* removed;
+            string username = "Checkpoint" + std::to_string(t);
+            for (int i = 0; i < 3000; i++) {
+                source.insert(Account(username, i, false, "", "Busy"));
+                if (i % 3 == 2)
+                    source.removeUser(username, i - 1, removed);
+            }
+            numDone++;
+        });
+    }
+    while (numDone < 3) {
+        if (!source.checkpoint("utree.snap"))
+            return false;
+    }
+    for (std::thread& writer : writers)
+        writer.join();
+    source.setLog(nullptr);
+    log.close();
+
+    UTree restored;
+    bool ok = restored.load("utree.snap") && restored.replay("utree.log") >= 0 &&
+              restored.numUsers("Pika") == source.numUsers("Pika");
+    std::remove("utree.snap");
+    std::remove("utree.log");
+    for (int t = 0; ok && t < 3; t++) {
+        string username = "Checkpoint" + std::to_string(t);
+        ok = restored.numUsers(username) == 2000;
+        for (int i = 0; ok && i < 3000; i++)
+            ok = restored.contains(username, i) == source.contains(username, i);
+    }
+    return ok;
+}
+
+bool Tester::testInsertBatch(UTree &utree) {
+    //the file in two batches builds the tree loading it line by line does
+    UTree serial;
+    serial.loadData("accounts.csv");
+    std::vector<Account> batches[2];
+    std::ifstream file("accounts.csv");
+    string username, disc, nitro, badge, status;
+    for (int i = 0; std::getline(file, username, ',') && std::getline(file, disc, ',') && std::getline(file, nitro, ',') &&
+                    std::getline(file, badge, ',') && std::getline(file, status); i++)
+        batches[i % 2].emplace_back(username, std::stoi(disc), std::stoi(nitro), badge, status);
+
+    int height;
+    int inserted = utree.insertBatch(batches[0]) + utree.insertBatch(batches[1]);
+    if (inserted != serial._dnodes->getNumLive() || utree._dnodes->getNumLive() != inserted ||
+        utree._unodes.getNumLive() != serial._unodes.getNumLive() || !checkUTreeAVL(utree._root, height))
+        return false;
+    for (Account& account : batches[0]) {
+        DNode* node = utree.retrieveUser(account.getUsername(), account.getDiscriminator());
+        DNode* expected = serial.retrieveUser(account.getUsername(), account.getDiscriminator());
+        if (!node || utree.numUsers(account.getUsername()) != serial.numUsers(account.getUsername()) ||
+            node->getAccount().getStatus() != expected->getAccount().getStatus())
+            return false;
+    }
+
+    //a few new usernames go in one at a time; the tree and then the batch win on duplicates
+    std::vector<Account> batch = {Account("Zed", 7, false, "", "First"), Account("Pika", 1, false, "", ""),
+                                  Account("Zed", 7, false, "", "Second"), batches[0][0], Account("Zed", 3, false, "", "")};
+    int numUNodes = utree._unodes.getNumLive();
+    if (utree.insertBatch(batch) != 3 || utree._unodes.getNumLive() != numUNodes + 1 || utree.numUsers("Zed") != 2 ||
+        utree.retrieveUser("Zed", 7)->getAccount().getStatus() != "First" || !checkUTreeAVL(utree._root, height))
+        return false;
+    if (utree.insertBatch(std::vector<Account>()) != 0 || utree._dnodes->getNumLive() != inserted + 3)
+        return false;
 
-bool Tester::checkUTreeBST(UNode *node) {
-    if (node->_right && node->_left && node->_left->getUsername() < node->getUsername() &&
-        node->_left->getUsername() < node->_right->getUsername()) {
-        //making sure the tree is balanced
-        checkUTreeBST(node->_left);
-        checkUTreeBST(node->_right);
-        return true;
+    //accounts without a valid disc are dropped before any UNode is made for them
+    batch = {Account(), Account("Yak", 5, false, "", ""), Account(), Account("Yak", 5, false, "", "")};
+    numUNodes = utree._unodes.getNumLive();
+    if (utree.insertBatch(batch) != 1 || utree._unodes.getNumLive() != numUNodes + 1 || utree.numUsers("") != 0 ||
+        utree.insertBatch(std::vector<Account>(3)) != 0 || utree._unodes.getNumLive() != numUNodes + 1)
+        return false;
+    UTree fresh;
+    if (fresh.insertBatch(batch) != 1 || fresh._unodes.getNumLive() != 1 || fresh._dnodes->getNumLive() != 1 ||
+        !checkUTreeAVL(fresh._root, height))
+        return false;
+
+    //with lock-free reads a new username rotates copies in for the UNodes of
+    //later runs, and their accounts still have to reach the live copies
+    UTree lockFree;
+    lockFree.setLockFreeReads(true);
+    lockFree.emplace("b", 1, false, "", "");
+    lockFree.emplace("f", 1, false, "", "");
+    if (lockFree.insertBatch({Account("c", 1, false, "", ""), Account("f", 2, false, "", "")}) != 2 ||
+        !lockFree.emplace("f", 3, false, "", "") || lockFree.numUsers("f") != 3)
+        return false;
+    batch.clear();
+    for (int k = 0; k < 40; k++) {
+        lockFree.emplace("User" + std::to_string(k * 2), 0, false, "", "");
+        batch.emplace_back("User" + std::to_string(k), 1, false, "", "");
     }
-    else
+    if (lockFree.insertBatch(batch) != 40)
         return false;
+    EpochGuard guard;
+    for (int k = 0; k < 40; k++) {
+        string username = "User" + std::to_string(k);
+        DNode* node = lockFree.retrieveUser(username, 1);
+        if (!node || node->getUsername() != username || lockFree.numUsers(username) != (k % 2 ? 1 : 2) ||
+            (k < 20 && lockFree.numUsers("User" + std::to_string(k * 2)) != 2))
+            return false;
+    }
+    return lockFree.retrieveUser("f", 2) && checkUTreeAVL(lockFree._root, height);
 }
 
-bool Tester::testUTreeRemoveRoot(UTree& utree){
-  DNode* remove;
-
-  Account newAcct = Account("Aqua",3922,1,"Subscriber","");
-  utree.insert(newAcct);
+bool Tester::testMultiGet(UTree &utree) {
+    //every account in the file, some twice, plus keys that miss, shuffled
+    utree.loadData("accounts.csv");
+    std::vector<std::pair<string, int>> keys = {{"Nobody", 5}, {"Pika", 10000}, {"", 0}};
+    std::ifstream file("accounts.csv");
+    string username, disc, line;
+    while (std::getline(file, username, ',') && std::getline(file, disc, ',') && std::getline(file, line)) {
+        keys.emplace_back(username, std::stoi(disc));
+        keys.emplace_back(username, std::stoi(disc) + 1);
+    }
+    keys.push_back(keys[3]);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+    utree.retrieve("Pika")->getDTree()->freeze();
+
+    //results come back in request order, matching one lookup at a time, with
+    //lock-free reads off and on
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<DNode*> results;
+        int numFound = utree.retrieveUsers(keys, results);
+        int expected = 0;
+        if (results.size() != keys.size())
+            return false;
+        for (unsigned int i = 0; i < keys.size(); i++) {
+            DNode* node = utree.retrieveUser(keys[i].first, keys[i].second);
+            expected += (node != nullptr);
+            if ((node == nullptr) != (results[i] == nullptr) ||
+                (node && (results[i]->getAccount().getUsername() != keys[i].first || results[i]->getDiscriminator() != keys[i].second)))
+                return false;
+        }
+        if (numFound != expected || numFound < 201)
+            return false;
+        utree.setLockFreeReads(true);
+    }
 
-  //remove the root and it's a leaf
-  utree.removeUser("Aqua",3922, remove);
-  if (utree.retrieve("Aqua"))
-    return false;
-  return true;
+    std::vector<DNode*> results(3);
+    return utree.retrieveUsers({}, results) == 0 && results.empty();
 }
 
-bool Tester::testUTreeRemoval(UTree& utree) {
-  Account newAcct = Account("Aqua5Seemly",3922,1,"Subscriber","");
-  utree.insert(newAcct);
-  Account new1Acct = Account("Brackle",9550,0,"","This is a status");
-  utree.insert(new1Acct);
-  Account new2Acct = Account("Capstan",4962,1,"Subscriber","proj2 :100:");
-  utree.insert(new2Acct);
-  Account new3Acct = Account("Capstan",7383,1,"","");
-  utree.insert(new3Acct);
-  Account new4Acct = Account("Cinnamon",5319,0,"Subscriber","");
-  utree.insert(new4Acct);
-  Account new5Acct = Account("Capstan",604,0,"","recursion(recursion(recursion()))");
-  utree.insert(new5Acct);
-  Account new6Acct = Account("Cinnamon",1180,0,"HypeSquad Brilliance","");
-  utree.insert(new6Acct);
-  Account new7Acct = Account("Pika",6130,0,"","");
-  utree.insert(new7Acct);
-  Account new8Acct = Account("Brackle",2725,0,"HypeSquad Brilliance","");
-  utree.insert(new8Acct);
-  Account new9Acct = Account("Aqua5Seemly",7300,0,"","");
-  utree.insert(new9Acct);
-  Account new10Acct = Account("Sulkyreal",8550,0,"Subscriber","");
-  utree.insert(new10Acct);
-  Account new11Acct = Account("A",7300,0,"","");
-  utree.insert(new11Acct);
-
-  DNode* removedNode;
-  //remove username with a left and right node and a left grandchild
-  utree.removeUser("Brackle", 9550, removedNode);
-  utree.removeUser("Brackle", 2725, removedNode);
-  
-  if (utree.retrieve("Brackle"))
-    return false;
-  
-  //remove username with a left and right node
-  utree.removeUser("Aqua5Seemly", 7300, removedNode);
-  utree.removeUser("Aqua5Seemly", 3922, removedNode);
+bool Tester::checkHashIndex(UTree &utree) {
+    //exactly the UNodes in the tree, each under its own username
+    std::vector<UNode*> nodes;
+    utree.flatten(utree._root, nodes);
+    if (utree._index.size() != (int)nodes.size())
+        return false;
+    for (UNode* node : nodes) {
+        if (utree._index.find(node->getUsername()) != node)
+            return false;
+    }
+    return true;
+}
 
-  //tests retrieve
-  if (utree.retrieve("Aqua5Seemly"))
-    return false;
-  
-  //remove username with a right and no left node
-  utree.removeUser("A", 7300, removedNode);
+bool Tester::testHashIndex(UTree &utree) {
+    //entries shift back on erase, so random churn must match a reference map
+    std::vector<UNode> unodes(500);
+    UsernameIndex index;
+    std::unordered_map<string, UNode*> reference;
+    std::mt19937 gen(11);
+    for (int i = 0; i < 5000; i++) {
+        UNode* node = &unodes[gen() % unodes.size()];
+        node->_username = "user" + std::to_string(node - unodes.data());
+        if (gen() % 3 == 0) {
+            if (index.erase(node->_username) != (reference.erase(node->_username) == 1))
+                return false;
+        }
+        else {
+            index.insert(node);
+            reference[node->_username] = node;
+        }
+    }
+    for (UNode& node : unodes) {
+        auto found = reference.find(node._username);
+        if (index.find(node._username) != (found == reference.end() ? nullptr : found->second))
+            return false;
+    }
+    if (index.size() != (int)reference.size())
+        return false;
 
-  //tests retrieve
-  if (utree.retrieve("A"))
-    return false;
+    //the tree keeps it up to date through loads, removals and batch rebuilds
+    utree.setHashIndex(true);
+    utree.loadData("accounts.csv");
+    if (!checkHashIndex(utree) || utree.retrieve("Pika") != utree.descend("Pika") || utree.retrieve("Nobody"))
+        return false;
+    std::vector<Account> batch;
+    for (int i = 0; i < 40; i++)
+        batch.emplace_back("Batch" + std::to_string(i), i, false, "", "");
+    utree.insertBatch(batch);
+    if (!checkHashIndex(utree))
+        return false;
 
-  //remove username leaf
-  utree.removeUser("Capstan",4962, removedNode);
-  utree.removeUser("Capstan",7383,removedNode);
-  utree.removeUser( "Capstan",604,removedNode);
+    //removing UNodes moves usernames between the ones left
+    DNode* removed;
+    for (int i = 0; i < 40; i += 3) {
+        utree.removeUser("Batch" + std::to_string(i), i, removed);
+        if (!checkHashIndex(utree) || utree.retrieve("Batch" + std::to_string(i)))
+            return false;
+    }
 
-  //tests retrieve
-  if (utree.retrieve("Capstan"))
-    return false;
+    //copies made by lock-free rotations take over their original's entry
+    utree.setLockFreeReads(true);
+    for (int i = 0; i < 40; i++)
+        utree.insert(Account("Free" + std::to_string(i), i, false, "", ""));
+    for (int i = 1; i < 40; i += 3)
+        utree.removeUser("Batch" + std::to_string(i), i, removed);
+    if (!checkHashIndex(utree))
+        return false;
+    utree.setLockFreeReads(false);
+    if (!checkHashIndex(utree) || utree.retrieveUser("Free7", 7) == nullptr || utree.numUsers("Batch1") != 0)
+        return false;
 
-  //make sure tree is balanced
-  if (utree.checkImbalance(utree._root))
-    return false;
+    utree.setHashIndex(false);
+    return utree._index.size() == 0 && utree.retrieveUser("Free7", 7) != nullptr;
+}
 
-  //remove root node, two right traversals to get to nodeX
-  Account new12Acct = Account("D",7300,0,"","");
-  utree.insert(new12Acct);
-  Account new13Acct = Account("Q",7300,0,"","");
-  utree.insert(new13Acct);
-  Account new14Acct = Account("E",7300,0,"","");
-  utree.insert(new14Acct);
-  Account new15Acct = Account("F",7300,0,"","");
-  utree.insert(new15Acct);
-  utree.removeUser( "Pika",6130,removedNode);
+bool Tester::testKeyPrefix(UTree &utree) {
+    //prefix comparisons order usernames exactly as string comparisons do,
+    //around the 8 byte mark, with embedded zeros and bytes past 0x7f
+    std::vector<string> usernames = {"", "a", "ab", string("ab\0", 3), string("ab\0\0\0\0\0\0\0", 9), "abcdefg",
+                                     "abcdefgh", "abcdefgha", "abcdefgh\xff", "abcdefghb", "\xff", "\x80zz", "Z", "zz"};
+    UNode node;
+    for (const string& a : usernames) {
+        node.setUsername(a);
+        for (const string& b : usernames) {
+            int cmp = node.compare(UNode::keyPrefix(b), b);
+            int expected = b.compare(a);
+            if ((cmp < 0) != (expected < 0) || (cmp == 0) != (expected == 0))
+                return false;
+        }
+    }
 
-  //tests retrieve
-  if (utree.retrieve("Pika"))
-    return false;
-  
-  return true;
+    //lookups and rotations still find every username
+    for (const string& username : usernames)
+        utree.insert(Account(username, 1, false, "", ""));
+    int height;
+    if (!checkUTreeAVL(utree._root, height))
+        return false;
+    for (const string& username : usernames) {
+        if (!utree.retrieveUser(username, 1) || utree.retrieve(username)->getUsername() != username)
+            return false;
+    }
+    DNode* removed;
+    for (unsigned int i = 0; i < usernames.size(); i += 2)
+        utree.removeUser(usernames[i], 1, removed);
+    for (unsigned int i = 0; i < usernames.size(); i++) {
+        if ((utree.retrieve(usernames[i]) != nullptr) != (i % 2 == 1))
+            return false;
+    }
+    return checkUTreeAVL(utree._root, height);
 }
 
 int main() {
@@ -581,6 +2138,114 @@ int main() {
         cout << "test failed" << endl;
 
 
+    //testing the direct-indexed backend
+    cout << "Testing DTree switching to and from the dense table" << endl;
+    DTree dense;
+    if (tester.testDenseBackend(dense))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
+    cout << "Testing frozen DTree lookups" << endl;
+    DTree frozen;
+    if (tester.testFrozenLayout(frozen))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
+    cout << "Testing DTree bulk load, sorted small batch" << endl;
+    DTree bulkSmall;
+    if (tester.testBulkLoad(bulkSmall, 50))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+    cout << "Testing DTree bulk load, bucketed large batch" << endl;
+    DTree bulkLarge;
+    if (tester.testBulkLoad(bulkLarge, 5000))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
+    cout << "Testing DTree under random inserts and removals" << endl;
+    DTree churn;
+    if (tester.testInsertRemoveChurn(churn))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
+    cout << "Testing DTree vacancy compaction" << endl;
+    DTree compact;
+    if (tester.testCompaction(compact))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
+    cout << "Testing in place and array rebalancing build the same tree" << endl;
+    DTree inPlace;
+    DTree array;
+    if (tester.testRebalanceModes(inPlace, array))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
+    cout << "Testing DTree rank, select and range counts" << endl;
+    DTree stats;
+    if (tester.testOrderStatistics(stats))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
+    cout << "Testing DTree range scans" << endl;
+    DTree scan;
+    if (tester.testRangeScan(scan))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
+    cout << "Testing DTree move construction and assignment" << endl;
+    DTree mover;
+    if (tester.testMoveSemantics(mover))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+    cout << "Testing accounts share interned badges and statuses" << endl;
+    if (tester.testInternedAccounts())
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+    cout << "Testing DNodes keep their accounts out of line" << endl;
+    DTree payloads;
+    if (tester.testNodePayloads(payloads))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+    cout << "Testing the B-tree DTree variant" << endl;
+    DBTree btree;
+    if (tester.testBTree(btree))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+    cout << "Testing DTree snapshots share nodes until written" << endl;
+    DTree snapped;
+    if (tester.testSnapshots(snapped))
+        cout << "test passed" << endl;
+    else
+        cout << "test failed" << endl;
+
+
     /* Basic UTree tests */
     UTree utree;
 
@@ -623,6 +2288,118 @@ int main() {
     else
         cout << "test failed" << endl;
 
+    cout << "Testing UTree reload and clear through the node pools" << endl;
+    UTree utree3;
+    if (tester.testUTreeReload(utree3))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree compaction pass" << endl;
+    UTree utree4;
+    if (tester.testUTreeCompaction(utree4))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing lowest free discriminator for signups" << endl;
+    UTree utree5;
+    if (tester.testLowestFreeDisc(utree5))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing occupancy bitmap queries" << endl;
+    UTree utree6;
+    if (tester.testOccupancyBitmap(utree6))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree insert moves accounts into place" << endl;
+    UTree utree7;
+    if (tester.testMoveInsert(utree7))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree snapshots outlive clear" << endl;
+    UTree utree8;
+    if (tester.testUTreeSnapshot(utree8))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing concurrent UTree writers and readers" << endl;
+    UTree utree9;
+    if (tester.testConcurrentUTree(utree9))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing lock-free UTree reads under writers" << endl;
+    UTree utree10;
+    if (tester.testLockFreeReads(utree10))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree parallel loading" << endl;
+    UTree utree11;
+    if (tester.testParallelLoad(utree11))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree memory-mapped loading" << endl;
+    UTree utree12;
+    if (tester.testMappedLoad(utree12))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree binary snapshot files" << endl;
+    UTree utree13;
+    if (tester.testSnapshotFile(utree13))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree write-ahead log and replay" << endl;
+    UTree utree14;
+    if (tester.testWriteLog(utree14))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree batch insertion" << endl;
+    UTree utree15;
+    if (tester.testInsertBatch(utree15))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree sorted multi-get" << endl;
+    UTree utree16;
+    if (tester.testMultiGet(utree16))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree username hash index" << endl;
+    UTree utree17;
+    if (tester.testHashIndex(utree17))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
+    cout << "Testing UTree username key prefixes" << endl;
+    UTree utree18;
+    if (tester.testKeyPrefix(utree18))
+      cout << "test passed" << endl;
+    else
+      cout << "test failed" << endl;
+
     cout << "Resulting UTree:" << endl;
 
     utree.dump();
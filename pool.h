@@ -0,0 +1,118 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * NodePool.h
+ * A slab allocator for tree nodes.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <vector>
+
+#define FIRST_SLAB_SIZE 8
+#define MAX_SLAB_SIZE 1024
+
+/**
+ * Hands out nodes from contiguous slabs and recycles released nodes through
+ * a free list. clear() destroys every live node and returns all slabs at once
+ * instead of freeing nodes one at a time. Slabs start small and double up to
+ * MAX_SLAB_SIZE so a tree with a handful of nodes doesn't pay for a full slab.
+ */
+template <class T>
+class NodePool {
+public:
+    NodePool(): _free(nullptr), _used(0), _numLive(0), _epoch(0) {}
+    ~NodePool() {clear();}
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    template <class... Args>
+    T* allocate(Args&&... args) {
+        Slot* slot = _free;
+        if (slot)
+            _free = slot->_next;
+        else
+            slot = nextSlot();
+
+        T* node = new (slot->_storage) T(std::forward<Args>(args)...);
+        slot->_live = true;
+        _numLive++;
+        return node;
+    }
+
+    void release(T* node) {
+        if (!node)
+            return;
+
+        Slot* slot = reinterpret_cast<Slot*>(reinterpret_cast<unsigned char*>(node) - offsetof(Slot, _storage));
+        node->~T();
+        slot->_live = false;
+        slot->_next = _free;
+        _free = slot;
+        _numLive--;
+    }
+
+    /* Destroys every live node and returns all slabs. Anything still holding a
+     * node from before the call can tell by comparing getEpoch(). */
+    void clear() {
+        _epoch++;
+
+        //types without destructors don't need the sweep at all
+        if (!std::is_trivially_destructible<T>::value) {
+            for (unsigned int s = 0; s < _slabs.size(); s++) {
+                int used = (s + 1 == _slabs.size()) ? _used : slabSize(s);
+                for (int i = 0; i < used; i++) {
+                    if (_slabs[s][i]._live) {
+                        _slabs[s][i]._live = false;
+                        reinterpret_cast<T*>(_slabs[s][i]._storage)->~T();
+                    }
+                }
+            }
+        }
+
+        for (unsigned int s = 0; s < _slabs.size(); s++)
+            delete [] _slabs[s];
+        _slabs.clear();
+        _free = nullptr;
+        _used = 0;
+        _numLive = 0;
+    }
+
+    /* Getters */
+    int getNumLive() const {return _numLive;}
+    int getNumSlabs() const {return _slabs.size();}
+    unsigned int getEpoch() const {return _epoch;}
+
+private:
+    struct Slot {
+        Slot* _next;
+        bool _live;
+        alignas(T) unsigned char _storage[sizeof(T)];
+    };
+
+    std::vector<Slot*> _slabs;
+    Slot* _free;
+    int _used;          /* slots handed out from the newest slab */
+    int _numLive;
+    unsigned int _epoch;
+
+    static int slabSize(int index) {
+        int size = FIRST_SLAB_SIZE;
+        for (int i = 0; i < index && size < MAX_SLAB_SIZE; i++)
+            size *= 2;
+        return size;
+    }
+
+    Slot* nextSlot() {
+        if (_slabs.empty() || _used == slabSize(_slabs.size() - 1)) {
+            _slabs.push_back(new Slot[slabSize(_slabs.size())]);
+            _used = 0;
+        }
+        return &_slabs.back()[_used++];
+    }
+};
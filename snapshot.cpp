@@ -0,0 +1,163 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * Snapshot.cpp
+ * Implementation for the UTreeImage class.
+ */
+
+#include "snapshot.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Destructor, unmaps the file.
+ */
+UTreeImage::~UTreeImage() {
+    close();
+}
+
+/**
+ * Maps a file written by UTree::save() and checks it end to end.
+ * @param path path to the snapshot file
+ * @return true if the file is mapped and valid, false otherwise
+ */
+bool UTreeImage::open(const string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(SnapshotHeader)) {
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    _data = (const char*)map;
+    _size = info.st_size;
+    _header = (const SnapshotHeader*)_data;
+    if (!validate()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Unmaps the file, if one is open.
+ */
+void UTreeImage::close() {
+    if (_data)
+        munmap((void*)_data, _size);
+    _data = nullptr;
+    _size = 0;
+}
+
+/**
+ * Copies out an account.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @param found set to the account if it exists
+ * @return true if the snapshot holds the account
+ */
+bool UTreeImage::findUser(const string& username, int disc, Account& found) const {
+    const SnapshotUsername* user = find(username);
+    if (!user)
+        return false;
+
+    //discs are sorted within the username
+    int lo = user->_first;
+    int hi = user->_first + user->_count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        const SnapshotAccount& account = _accounts[mid];
+        if (account._disc == disc) {
+            found = Account(username, disc, account._flags & NITRO_FLAG, string(text(_strings[account._badge])),
+                            string(text(_strings[account._status])));
+            return true;
+        }
+        if (account._disc < disc)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return false;
+}
+
+/**
+ * Returns the number of accounts with a specific username.
+ * @param username username to match
+ * @return number of accounts with the specified username
+ */
+int UTreeImage::numUsers(const string& username) const {
+    const SnapshotUsername* user = find(username);
+    return user ? user->_count : 0;
+}
+
+//every size, offset and index in the file is in bounds, and the usernames and
+//discs are in order, so lookups can trust what they read
+bool UTreeImage::validate() {
+    if (_header->_magic != SNAPSHOT_MAGIC || _header->_version != SNAPSHOT_VERSION)
+        return false;
+
+    uint64_t size = sizeof(SnapshotHeader) + (uint64_t)_header->_numUsernames * sizeof(SnapshotUsername) +
+                    (uint64_t)_header->_numAccounts * sizeof(SnapshotAccount) +
+                    (uint64_t)_header->_numStrings * sizeof(SnapshotString) + _header->_charBytes;
+    if (size != _size || _header->_numStrings == 0)
+        return false;
+
+    _usernames = (const SnapshotUsername*)(_data + sizeof(SnapshotHeader));
+    _accounts = (const SnapshotAccount*)(_usernames + _header->_numUsernames);
+    _strings = (const SnapshotString*)(_accounts + _header->_numAccounts);
+    _chars = (const char*)(_strings + _header->_numStrings);
+
+    for (uint32_t i = 0; i < _header->_numStrings; i++) {
+        if ((uint64_t)_strings[i]._offset + _strings[i]._length > _header->_charBytes)
+            return false;
+    }
+
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < _header->_numUsernames; i++) {
+        const SnapshotUsername& user = _usernames[i];
+        if ((uint64_t)user._name._offset + user._name._length > _header->_charBytes ||
+            user._first != next || user._count == 0 || user._count > _header->_numAccounts - next)
+            return false;
+        if (i > 0 && text(_usernames[i - 1]._name) >= text(user._name))
+            return false;
+
+        for (uint32_t j = user._first; j < user._first + user._count; j++) {
+            const SnapshotAccount& account = _accounts[j];
+            if (account._disc < MIN_DISC || account._disc > MAX_DISC || (j > user._first && _accounts[j - 1]._disc >= account._disc) ||
+                account._badge >= _header->_numStrings || account._status >= _header->_numStrings)
+                return false;
+        }
+        next += user._count;
+    }
+    return next == _header->_numAccounts;
+}
+
+//binary search of the sorted usernames
+const SnapshotUsername* UTreeImage::find(const string& username) const {
+    if (!_data)
+        return nullptr;
+
+    int lo = 0;
+    int hi = (int)_header->_numUsernames - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = text(_usernames[mid]._name).compare(username);
+        if (cmp == 0)
+            return &_usernames[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return nullptr;
+}
@@ -0,0 +1,96 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * Snapshot.h
+ * The binary file format UTree::save() writes, and a memory-mapped view of it.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include "dtree.h"
+
+#define SNAPSHOT_MAGIC 0x53545455   /* "UTTS" read as a little-endian word */
+#define SNAPSHOT_VERSION 1
+
+/*
+ * Layout, in native byte order, every section 4-byte aligned:
+ *   SnapshotHeader
+ *   SnapshotUsername[_numUsernames]   sorted by username
+ *   SnapshotAccount[_numAccounts]     grouped by username, sorted by disc within a group
+ *   SnapshotString[_numStrings]       badges and statuses, entry 0 is ""
+ *   char[_charBytes]                  text of the usernames and strings, not terminated
+ */
+struct SnapshotHeader {
+    uint32_t _magic;
+    uint32_t _version;
+    uint32_t _numUsernames;
+    uint32_t _numAccounts;
+    uint32_t _numStrings;
+    uint32_t _reserved;
+    uint64_t _charBytes;
+};
+
+struct SnapshotString {
+    uint32_t _offset;   /* into the text */
+    uint32_t _length;
+};
+
+struct SnapshotUsername {
+    SnapshotString _name;
+    uint32_t _first;    /* index of the username's first account */
+    uint32_t _count;
+};
+
+struct SnapshotAccount {
+    int16_t _disc;
+    uint8_t _flags;
+    uint8_t _reserved;
+    uint32_t _badge;    /* index into the strings */
+    uint32_t _status;
+};
+
+static_assert(sizeof(SnapshotHeader) == 32 && sizeof(SnapshotUsername) == 16 &&
+              sizeof(SnapshotAccount) == 12 && sizeof(SnapshotString) == 8, "snapshot layout changed");
+
+/**
+ * Answers queries straight from a mapped snapshot file, without building a
+ * tree: a binary search over the usernames, then over that username's
+ * discriminators. open() checks the whole file once, so a file that opens
+ * can be searched without further bounds checks.
+ */
+class UTreeImage {
+    friend class UTree;
+    friend class Tester;
+
+public:
+    UTreeImage(): _data(nullptr), _size(0) {}
+    ~UTreeImage();
+
+    UTreeImage(const UTreeImage&) = delete;
+    UTreeImage& operator=(const UTreeImage&) = delete;
+
+    bool open(const string& path);
+    void close();
+    bool findUser(const string& username, int disc, Account& found) const;
+    int numUsers(const string& username) const;
+
+    /* Getters */
+    bool isOpen() const {return _data != nullptr;}
+    int getNumUsernames() const {return _data ? _header->_numUsernames : 0;}
+    int getNumAccounts() const {return _data ? _header->_numAccounts : 0;}
+
+private:
+    const char* _data;
+    size_t _size;
+    const SnapshotHeader* _header;
+    const SnapshotUsername* _usernames;
+    const SnapshotAccount* _accounts;
+    const SnapshotString* _strings;
+    const char* _chars;
+
+    bool validate();
+    const SnapshotUsername* find(const string& username) const;
+    std::string_view text(const SnapshotString& str) const {return std::string_view(_chars + str._offset, str._length);}
+};
@@ -0,0 +1,119 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * StringDict.cpp
+ * Implementation for the StringDict class.
+ */
+
+#include "strdict.h"
+
+/**
+ * Starts out holding only the empty string, as id 0.
+ */
+StringDict::StringDict() {
+    for (int i = 0; i < DICT_NUM_CHUNKS; i++)
+        _chunks[i] = nullptr;
+    _chunks[0] = new Entry[DICT_CHUNK_SIZE];
+    _next = 1;
+}
+
+/**
+ * Destructor, deletes all dynamic memory.
+ */
+StringDict::~StringDict() {
+    for (int i = 0; i < DICT_NUM_CHUNKS; i++)
+        delete [] _chunks[i];
+}
+
+/**
+ * Finds the id of a string, adding the string if it is new, and takes a
+ * reference to it.
+ * @param str string to look up
+ * @return id that lookup() turns back into str, to be handed to release()
+ */
+uint32_t StringDict::intern(const std::string& str) {
+    if (str.empty())
+        return 0;
+
+    std::lock_guard<std::mutex> guard(_lock);
+    auto found = _ids.find(str);
+    if (found != _ids.end()) {
+        entry(found->second)._refs.fetch_add(1, std::memory_order_relaxed);
+        return found->second;
+    }
+
+    uint32_t id;
+    if (!_free.empty()) {
+        id = _free.back();
+        _free.pop_back();
+    }
+    else {
+        //out of ids, fall back to the empty string rather than throw
+        if (_next == (uint32_t)(((uint64_t)DICT_CHUNK_SIZE << DICT_NUM_CHUNKS) - DICT_CHUNK_SIZE))
+            return 0;
+        id = _next++;
+        int chunk = chunkOf(id);
+        if (!_chunks[chunk])
+            _chunks[chunk] = new Entry[(size_t)DICT_CHUNK_SIZE << chunk];
+    }
+
+    Entry& added = entry(id);
+    added._str = str;
+    added._refs.store(1, std::memory_order_relaxed);
+    _ids.emplace(added._str, id);
+    return id;
+}
+
+/**
+ * Takes another reference to a string already held, as when an Account is
+ * copied.
+ * @param id id held by the caller
+ * @return the same id
+ */
+uint32_t StringDict::acquire(uint32_t id) {
+    if (id != 0)
+        entry(id)._refs.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+/**
+ * Drops a reference, freeing the string when it was the last one.
+ * @param id id held by the caller, not to be used after
+ */
+void StringDict::release(uint32_t id) {
+    if (id == 0)
+        return;
+
+    //only the last reference needs the lock, intern() may be reviving it
+    std::atomic<uint32_t>& refs = entry(id)._refs;
+    uint32_t count = refs.load(std::memory_order_relaxed);
+    while (count > 1) {
+        if (refs.compare_exchange_weak(count, count - 1, std::memory_order_acq_rel))
+            return;
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        _ids.erase(entry(id)._str);
+        std::string().swap(entry(id)._str);
+        _free.push_back(id);
+    }
+}
+
+/**
+ * Returns the number of distinct strings held, the empty string included.
+ * @return number of strings with an Account referring to them
+ */
+uint32_t StringDict::size() const {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _ids.size() + 1;
+}
+
+/**
+ * The dictionary every Account interns into.
+ * @return the shared dictionary
+ */
+StringDict& StringDict::global() {
+    static StringDict dict;
+    return dict;
+}
@@ -0,0 +1,69 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * StringDict.h
+ * A reference-counted dictionary of interned strings, shared by every Account.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define DICT_CHUNK_SIZE 1024    /* strings in the first chunk, each later chunk doubles */
+#define DICT_NUM_CHUNKS 22      /* enough chunks to hand out nearly every 32-bit id */
+
+/**
+ * Hands out a small id per distinct string, so an Account keeps 4 bytes per
+ * badge or status instead of a whole std::string. Id 0 is always the empty
+ * string. Strings live in chunks that never move, so lookup() needs no lock;
+ * intern() takes a lock to add new strings.
+ *
+ * Every id an Account holds is a counted reference: intern() and acquire()
+ * take one, release() drops one, and the string is freed and its id reused
+ * once the last Account holding it is gone, so clearing or reloading a tree
+ * gives its strings back. A reference returned by lookup() stays valid while
+ * the id is held. Should the ids run out, intern() returns 0 and the string
+ * reads back empty, rather than throwing out of an Account constructor
+ * halfway through a load.
+ */
+class StringDict {
+public:
+    StringDict();
+    ~StringDict();
+
+    StringDict(const StringDict&) = delete;
+    StringDict& operator=(const StringDict&) = delete;
+
+    uint32_t intern(const std::string& str);
+    uint32_t acquire(uint32_t id);
+    void release(uint32_t id);
+    const std::string& lookup(uint32_t id) const {return entry(id)._str;}
+    uint32_t size() const;
+
+    static StringDict& global();
+
+private:
+    struct Entry {
+        std::string _str;
+        std::atomic<uint32_t> _refs;
+    };
+
+    Entry* _chunks[DICT_NUM_CHUNKS];
+    uint32_t _next;                 /* ids handed out so far, the empty string included */
+    std::vector<uint32_t> _free;    /* ids of released strings, handed out again first */
+    std::unordered_map<std::string_view, uint32_t> _ids;    /* keys point at the strings in the chunks */
+    mutable std::mutex _lock;
+
+    //chunk k holds DICT_CHUNK_SIZE << k ids, starting where chunk k - 1 ends
+    static int chunkOf(uint32_t id) {return 31 - __builtin_clz(id / DICT_CHUNK_SIZE + 1);}
+    Entry& entry(uint32_t id) const {
+        int chunk = chunkOf(id);
+        return _chunks[chunk][id + DICT_CHUNK_SIZE - ((uint32_t)DICT_CHUNK_SIZE << chunk)];
+    }
+};
@@ -0,0 +1,111 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * UsernameIndex.cpp
+ * Implementation for the UsernameIndex class.
+ */
+
+#include "uindex.h"
+#include "utree.h"
+
+/**
+ * Destructor, frees the slots. The UNodes belong to the tree.
+ */
+UsernameIndex::~UsernameIndex() {
+    delete [] _slots;
+}
+
+/**
+ * Looks up the UNode holding a username.
+ * @param username username to match
+ * @return UNode with a matching username, nullptr otherwise
+ */
+UNode* UsernameIndex::find(const std::string& username) const {
+    if (_size == 0)
+        return nullptr;
+    return _slots[locate(username, std::hash<std::string>()(username))]._node;
+}
+
+/**
+ * Adds a UNode under its current username, replacing the entry for that
+ * username if there is one.
+ * @param node UNode to index
+ */
+void UsernameIndex::insert(UNode* node) {
+    if ((size_t)(_size + 1) * INDEX_MAX_LOAD > _capacity)
+        grow();
+
+    size_t hash = std::hash<std::string>()(node->getUsername());
+    size_t slot = locate(node->getUsername(), hash);
+    if (!_slots[slot]._node)
+        _size++;
+    _slots[slot] = {hash, node};
+}
+
+/**
+ * Removes the entry for a username.
+ * @param username username to match
+ * @return true if there was an entry, false otherwise
+ */
+bool UsernameIndex::erase(const std::string& username) {
+    if (_size == 0)
+        return false;
+
+    size_t mask = _capacity - 1;
+    size_t hole = locate(username, std::hash<std::string>()(username));
+    if (!_slots[hole]._node)
+        return false;
+    _slots[hole]._node = nullptr;
+    _size--;
+
+    //pull back every entry of the run that the hole would cut off from its home slot
+    for (size_t next = (hole + 1) & mask; _slots[next]._node; next = (next + 1) & mask) {
+        size_t home = _slots[next]._hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            _slots[hole] = _slots[next];
+            _slots[next]._node = nullptr;
+            hole = next;
+        }
+    }
+    return true;
+}
+
+/**
+ * Removes every entry, keeping the slots for reuse.
+ */
+void UsernameIndex::clear() {
+    for (size_t i = 0; i < _capacity; i++)
+        _slots[i]._node = nullptr;
+    _size = 0;
+}
+
+//slot holding username, or the free slot ending its probe run
+size_t UsernameIndex::locate(const std::string& username, size_t hash) const {
+    size_t mask = _capacity - 1;
+    size_t slot = hash & mask;
+    while (_slots[slot]._node &&
+           (_slots[slot]._hash != hash || _slots[slot]._node->getUsername() != username))
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+//double the slots and put every entry back
+void UsernameIndex::grow() {
+    Slot* old = _slots;
+    size_t oldCapacity = _capacity;
+    _capacity = _capacity ? _capacity * 2 : INDEX_MIN_CAPACITY;
+    _slots = new Slot[_capacity];
+    for (size_t i = 0; i < _capacity; i++)
+        _slots[i]._node = nullptr;
+
+    size_t mask = _capacity - 1;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (!old[i]._node)
+            continue;
+        size_t slot = old[i]._hash & mask;
+        while (_slots[slot]._node)
+            slot = (slot + 1) & mask;
+        _slots[slot] = old[i];
+    }
+    delete [] old;
+}
@@ -0,0 +1,54 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * UsernameIndex.h
+ * An open-addressing hash index from username to UNode.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#define INDEX_MIN_CAPACITY 16   /* slots in a new index, always a power of two */
+#define INDEX_MAX_LOAD 2        /* grow once more than 1/INDEX_MAX_LOAD of the slots are full */
+
+class UNode;
+
+/**
+ * Linear probing over a power-of-two table of slots holding a UNode and the
+ * hash of its username. The username itself is not copied: probes compare
+ * the stored hash first and only read the UNode's username when it matches,
+ * so a lookup is usually one string compare. erase() shifts the rest of the
+ * probe run back rather than leaving tombstones.
+ */
+class UsernameIndex {
+public:
+    UsernameIndex(): _slots(nullptr), _capacity(0), _size(0) {}
+    ~UsernameIndex();
+
+    UsernameIndex(const UsernameIndex&) = delete;
+    UsernameIndex& operator=(const UsernameIndex&) = delete;
+
+    UNode* find(const std::string& username) const;
+    void insert(UNode* node);
+    bool erase(const std::string& username);
+    void clear();
+
+    /* Getters */
+    int size() const {return _size;}
+    size_t getCapacity() const {return _capacity;}
+
+private:
+    struct Slot {
+        size_t _hash;
+        UNode* _node;       /* nullptr if the slot is free */
+    };
+
+    Slot* _slots;
+    size_t _capacity;
+    int _size;
+
+    size_t locate(const std::string& username, size_t hash) const;
+    void grow();
+};
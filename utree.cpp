@@ -6,6 +6,22 @@
  */
 
 #include "utree.h"
+#include "snapshot.h"
+#include "wal.h"
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <iterator>
+#include <charconv>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 /**
  * Destructor, deletes all dynamic memory.
@@ -19,8 +35,9 @@ UTree::~UTree() {
  * Sources a .csv file to populate Account objects and insert them into the UTree.
  * @param infile path to .csv file containing database of accounts
  * @param append true to append to an existing tree structure or false to clear before importing
+ * @param numThreads threads to parse and insert with, 1 to go line by line
  */
-void UTree::loadData(string infile, bool append) {
+void UTree::loadData(string infile, bool append, int numThreads) {
     std::ifstream instream(infile);
     string line;
     char delim = ',';
@@ -36,13 +53,24 @@ void UTree::loadData(string infile, bool append) {
     /* Should we append or clear? */
     if(!append) this->clear();
 
+    /* Large files are read whole and split between the threads */
+    if(numThreads > 1) {
+        string data;
+        instream.seekg(0, std::ios::end);
+        data.resize(instream.tellg());
+        instream.seekg(0, std::ios::beg);
+        instream.read(&data[0], data.size());
+        loadChunks(data, numThreads);
+        return;
+    }
+
     /* Read in the data from the .csv file and insert into the UTree */
     while(std::getline(instream, line)) {
         std::stringstream buffer(line);
 
         /* Quick check to make sure each line is formatted correctly */
         int delimCount = 0;
-        for(unsigned int c = 0; c < buffer.str().length(); c++) if(buffer.str()[c] == delim) delimCount++;
+        for(unsigned int c = 0; c < line.length(); c++) if(line[c] == delim) delimCount++;
         if(delimCount != numFields - 1) {
             throw std::invalid_argument("Malformed input file detected - ensure each line contains 5 fields deliminated by a ','");
         }
@@ -53,8 +81,7 @@ void UTree::loadData(string infile, bool append) {
             std::getline(buffer, line, delim);
             fields[i] = line;
         }
-        Account newAcct = Account(fields[0], std::stoi(fields[1]), std::stoi(fields[2]), fields[3], fields[4]);
-        this->insert(newAcct);
+        this->emplace(fields[0], std::stoi(fields[1]), std::stoi(fields[2]), fields[3], fields[4]);
     }
 }
 
@@ -65,11 +92,655 @@ void UTree::loadData(string infile, bool append) {
  * @param newAcct Account object to be inserted into the corresponding DTree
  * @return true if the account was inserted, false otherwise
  */
-bool UTree::insert(Account newAcct) {
+bool UTree::insert(Account&& newAcct) {
+    //DTrees turn these down, don't leave an empty UNode behind
+    if (newAcct.getDiscriminator() < MIN_DISC || newAcct.getDiscriminator() > MAX_DISC)
+        return false;
+
+    //logged while the write still holds its locks, so the log keeps the order
+    //writes to a username were applied in
+    string record = _log ? WriteLog::insertRecord(newAcct) : string();
+
+    //a username that already has a UNode only needs that UNode locked
+    if (_concurrent && !_lockFree) {
+        ReadLock tree = readLock(_lock);
+        UNode* node = find(newAcct.getUsername());
+        if (node) {
+            WriteLock dtree = writeLock(node->_lock);
+            return logged(node->getDTree()->insert(std::move(newAcct)), record);
+        }
+    }
+
+    //a new UNode may rotate the tree, so nobody else may be in it
+    WriteLock tree = writeLock(_lock);
+    if (!_lockFree)
+        return logged(insertUNode(std::move(newAcct)), record);
+
+    //lock-free readers see the account once the username's view is republished
+    string username = newAcct.getUsername();
+    if (!insertUNode(std::move(newAcct)))
+        return false;
+    publish(find(username));
+    return logged(true, record);
+}
+
+//append the record of a write that went through
+bool UTree::logged(bool applied, const string& record) {
+    if (applied && _log)
+        _log->append(record);
+    return applied;
+}
+
+/**
+ * Inserts a batch of accounts. The batch is sorted by username and disc, so
+ * each username is looked up once and its DTree takes its whole group in a
+ * single bulk load. Usernames new to the tree are merged in with one
+ * balanced rebuild of the AVL links when there are enough of them, rather
+ * than an insert and rebalance each. As with insert(), an account already in
+ * the tree wins over the batch and the first of a duplicate in the batch wins.
+ * @param accounts accounts to insert, in any order
+ * @return number of accounts inserted
+ */
+int UTree::insertBatch(std::vector<Account> accounts) {
+    //DTrees turn these down, drop them before a UNode is made for them
+    accounts.erase(std::remove_if(accounts.begin(), accounts.end(), [](const Account& account) {
+        return account._disc < MIN_DISC || account._disc > MAX_DISC;
+    }), accounts.end());
+
+    std::stable_sort(accounts.begin(), accounts.end(), [](const Account& a, const Account& b) {
+        int cmp = a._username.compare(b._username);
+        return cmp < 0 || (cmp == 0 && a._disc < b._disc);
+    });
+
+    //one run per username, holding its UNode if it has one
+    WriteLock tree = writeLock(_lock);
+    std::vector<std::pair<size_t, UNode*>> runs;
+    int numNew = 0;
+    for (size_t i = 0; i < accounts.size(); i++) {
+        if (i == 0 || accounts[i]._username != accounts[i - 1]._username) {
+            runs.emplace_back(i, find(accounts[i]._username));
+            if (!runs.back().second)
+                numNew++;
+        }
+    }
+    runs.emplace_back(accounts.size(), nullptr);
+
+    if (numNew > 0 && !_lockFree && (size_t)numNew * BATCH_REBUILD_RATIO >= (size_t)_unodes.getNumLive())
+        mergeUNodes(accounts, runs);
+
+    int inserted = 0;
+    bool added = false;
+    std::vector<Account> group;
+    std::vector<string> records;
+    for (size_t r = 0; r + 1 < runs.size(); r++) {
+        //in lock-free mode a rotation swaps copies in for the UNodes it
+        //moves, so once a UNode has gone in the saved ones may be retired
+        UNode* node = runs[r].second;
+        if (_lockFree && added)
+            node = find(accounts[runs[r].first]._username);
+
+        //duplicates are dropped here, so everything left in the group goes in
+        group.clear();
+        int last = INVALID_DISC;
+        for (size_t i = runs[r].first; i < runs[r + 1].first; i++) {
+            int disc = accounts[i]._disc;
+            if (disc == last || (node && node->getDTree()->contains(disc)))
+                continue;
+            last = disc;
+            group.push_back(std::move(accounts[i]));
+        }
+        if (group.empty())
+            continue;
+
+        //a username still missing goes in the usual way with its first
+        //account, which the bulk load then skips as a duplicate
+        if (!node) {
+            inserted += insertUNode(Account(group[0]));
+            node = find(group[0]._username);
+            added = true;
+        }
+        records.clear();
+        for (size_t i = 0; _log && i < group.size(); i++)
+            records.push_back(WriteLog::insertRecord(group[i]));
+        inserted += node->getDTree()->bulkLoad(std::move(group));
+        if (_lockFree)
+            publish(node);
+
+        for (const string& record : records)
+            _log->append(record);
+    }
+    return inserted;
+}
+
+//parallel loadData: each thread parses a newline-aligned chunk and deals its
+//accounts out by username, then each thread gathers one share of the
+//usernames into groups. New UNodes go in one at a time, the groups are bulk
+//loaded into their DTrees in parallel. A malformed line throws before
+//anything is inserted.
+void UTree::loadChunks(const string& data, int numThreads) {
+    std::vector<size_t> bounds(numThreads + 1, data.size());
+    bounds[0] = 0;
+    for (int t = 1; t < numThreads; t++) {
+        //move on to the start of a line
+        size_t pos = std::max(bounds[t - 1], data.size() / numThreads * t);
+        if (pos > 0 && data[pos - 1] != '\n') {
+            pos = data.find('\n', pos);
+            pos = (pos == string::npos) ? data.size() : pos + 1;
+        }
+        bounds[t] = pos;
+    }
+
+    //parts[t][h] holds the accounts chunk t dealt to share h, in file order
+    std::vector<std::vector<std::vector<Account>>> parts(numThreads);
+    std::vector<std::exception_ptr> errors(numThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        parts[t].resize(numThreads);
+        threads.emplace_back([&, t]() {
+            try {
+                parseChunk(data, bounds[t], bounds[t + 1], parts[t]);
+            }
+            catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    for (std::exception_ptr& error : errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    //group each share by username, keeping file order so the first duplicate wins
+    std::vector<std::vector<std::vector<Account>>> groups(numThreads);
+    threads.clear();
+    for (int h = 0; h < numThreads; h++) {
+        threads.emplace_back([&, h]() {
+            std::unordered_map<string, int> index;
+            for (int t = 0; t < numThreads; t++) {
+                for (Account& account : parts[t][h]) {
+                    auto found = index.emplace(account.getUsername(), groups[h].size());
+                    if (found.second)
+                        groups[h].emplace_back();
+                    groups[h][found.first->second].push_back(std::move(account));
+                }
+                parts[t][h].clear();
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    //a group's first account goes in the usual way, creating the UNode if it's new
+    WriteLock tree = writeLock(_lock);
+    std::vector<std::pair<UNode*, std::vector<Account>*>> loads;
+    for (std::vector<std::vector<Account>>& share : groups) {
+        for (std::vector<Account>& group : share) {
+            if (insertUNode(Account(group[0])) && _log)
+                _log->append(WriteLog::insertRecord(group[0]));
+            loads.emplace_back(nullptr, &group);
+        }
+    }
+    for (auto& load : loads)
+        load.first = find((*load.second)[0].getUsername());
+
+    //the tree holds still now, the DTrees take the rest in parallel
+    _dnodes->setLocking(true);
+    threads.clear();
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&, t]() {
+            for (unsigned int i = t; i < loads.size(); i += numThreads) {
+                if (_log)
+                    logGroup(loads[i].first->getDTree(), *loads[i].second);
+                loads[i].first->getDTree()->bulkLoad(std::move(*loads[i].second));
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    _dnodes->setLocking(_concurrent);
+
+    if (_lockFree) {
+        for (auto& load : loads)
+            publish(load.first);
+    }
+}
+
+//cut a group down to the accounts its bulk load will insert, first in the
+//file winning, and log them the way insert() would
+void UTree::logGroup(DTree* dtree, std::vector<Account>& group) {
+    DiscBitmap seen;
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < group.size(); i++) {
+        if (dtree->contains(group[i]._disc) || seen.test(group[i]._disc))
+            continue;
+        seen.set(group[i]._disc);
+        _log->append(WriteLog::insertRecord(group[i]));
+        if (kept != i)
+            group[kept] = std::move(group[i]);
+        kept++;
+    }
+    group.resize(kept);
+}
+
+//parse the lines in [begin, end) as loadData does, dealing each account to
+//the part its username hashes to
+void UTree::parseChunk(const string& data, size_t begin, size_t end, std::vector<std::vector<Account>>& parts) {
+    const char delim = ',';
+    const int numFields = 5;
+    string fields[numFields];
+    std::hash<string> hash;
+
+    while (begin < end) {
+        size_t eol = std::min(data.find('\n', begin), end);
+        if (std::count(data.begin() + begin, data.begin() + eol, delim) != numFields - 1) {
+            throw std::invalid_argument("Malformed input file detected - ensure each line contains 5 fields deliminated by a ','");
+        }
+
+        for (int i = 0; i < numFields; i++) {
+            size_t next = (i < numFields - 1) ? data.find(delim, begin) : eol;
+            fields[i].assign(data, begin, next - begin);
+            begin = next + 1;
+        }
+        begin = eol + 1;
+
+        Account account(fields[0], std::stoi(fields[1]), std::stoi(fields[2]), fields[3], fields[4]);
+        parts[hash(fields[0]) % parts.size()].push_back(std::move(account));
+    }
+}
+
+/**
+ * Maps a .csv file into memory and inserts its accounts, like loadData()
+ * but without copying lines around. Rows that don't parse are skipped and
+ * listed in the report rather than ending the load.
+ * @param infile path to .csv file containing database of accounts
+ * @param report set to the number of rows read and inserted, and the rows skipped
+ * @param append true to append to an existing tree structure or false to clear before importing
+ * @return true if every row parsed, false if the report lists errors
+ */
+bool UTree::loadMapped(const string& infile, LoadReport& report, bool append) {
+    const int numFields = 5;
+    std::string_view fields[numFields];
+    report = LoadReport();
+
+    /* A file that can't be read is the only error reported as line 0 */
+    int fd = open(infile.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) < 0) {
+        if(fd >= 0) close(fd);
+        report._errors.push_back({0, "File " + infile + " could not be opened or located", ""});
+        return false;
+    }
+
+    size_t size = info.st_size;
+    const char* data = nullptr;
+    if(size > 0) {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED) {
+            close(fd);
+            report._errors.push_back({0, "File " + infile + " could not be mapped", ""});
+            return false;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        data = (const char*)map;
+    }
+    close(fd);
+
+    if(!append) this->clear();
+
+    const char* pos = data;
+    const char* end = data + size;
+    while(pos < end) {
+        //split the line into views of its fields
+        const char* field = pos;
+        const char* stop;
+        int count = 0;
+        do {
+            stop = scanDelim(field, end);
+            if(count < numFields) fields[count] = std::string_view(field, stop - field);
+            count++;
+            field = stop + 1;
+        } while(stop < end && *stop == ',');
+
+        std::string_view row(pos, stop - pos);
+        pos = (stop < end) ? stop + 1 : end;
+        report._numRows++;
+
+        int disc, nitro;
+        const char* reason = nullptr;
+        if(count != numFields)
+            reason = "Expected 5 fields deliminated by a ','";
+        else if(!parseField(fields[1], disc))
+            reason = "Discriminator is not a number";
+        else if(disc < MIN_DISC || disc > MAX_DISC)
+            reason = "Discriminator out of valid range";
+        else if(!parseField(fields[2], nitro))
+            reason = "Nitro flag is not a number";
+
+        if(reason) {
+            report._errors.push_back({report._numRows, reason, string(row)});
+            continue;
+        }
+        if(emplace(string(fields[0]), disc, nitro, string(fields[3]), string(fields[4])))
+            report._numInserted++;
+    }
+
+    if(size > 0) munmap((void*)data, size);
+    return report._errors.empty();
+}
+
+/**
+ * Writes every account to a versioned binary file, laid out as described in
+ * snapshot.h. The file is written beside path, synced, and renamed over it,
+ * and the directory synced after, so once save() returns true the snapshot
+ * survives a crash and a failed save leaves the old file in place.
+ * @param path path of the snapshot file
+ * @return true if the file was written, false otherwise
+ */
+bool UTree::save(const string& path) const {
+    ReadLock tree = readLock(_lock);
+    return saveLocked(path);
+}
+
+/**
+ * Saves a snapshot and empties the attached WriteLog in one step. Every
+ * logged write appends while it holds the tree lock, and the lock is held
+ * exclusive across both, so no write can land in between and end up in
+ * neither the snapshot nor the log. Calling save() and then truncate() on
+ * the log leaves that gap open.
+ * @param path path of the snapshot file
+ * @return true if the snapshot was written and the log, if any, emptied
+ */
+bool UTree::checkpoint(const string& path) {
+    WriteLock tree = writeLock(_lock);
+    if (!saveLocked(path))
+        return false;
+    return !_log || _log->truncate();
+}
+
+//save() proper, the caller holds the tree lock
+bool UTree::saveLocked(const string& path) const {
+    std::vector<UNode*> nodes;
+    collect(_root, nodes);
+
+    std::vector<SnapshotUsername> usernames;
+    std::vector<SnapshotAccount> accounts;
+    std::vector<SnapshotString> strings(1, SnapshotString{0, 0});
+    std::unordered_map<uint32_t, uint32_t> index({{0, 0}});     /* dictionary id to string entry */
+    string chars;
+
+    for (UNode* node : nodes) {
+        ReadLock dtree = readLock(node->_lock);
+        usernames.push_back({{(uint32_t)chars.size(), (uint32_t)node->_username.size()}, (uint32_t)accounts.size(), 0});
+        chars += node->_username;
+
+        for (DRangeIterator it = node->getDTree()->scan(MIN_DISC, MAX_DISC); it.hasNext();) {
+            const Account& account = it.next();
+            for (uint32_t id : {account._badge, account._status}) {
+                if (index.emplace(id, strings.size()).second) {
+                    const string& str = StringDict::global().lookup(id);
+                    strings.push_back({(uint32_t)chars.size(), (uint32_t)str.size()});
+                    chars += str;
+                }
+            }
+            accounts.push_back({account._disc, account._flags, 0, index[account._badge], index[account._status]});
+        }
+        usernames.back()._count = accounts.size() - usernames.back()._first;
+    }
+
+    SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, (uint32_t)usernames.size(), (uint32_t)accounts.size(),
+                             (uint32_t)strings.size(), 0, chars.size()};
+    string temp = path + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)usernames.data(), usernames.size() * sizeof(SnapshotUsername));
+    out.write((const char*)accounts.data(), accounts.size() * sizeof(SnapshotAccount));
+    out.write((const char*)strings.data(), strings.size() * sizeof(SnapshotString));
+    out.write(chars.data(), chars.size());
+    out.close();
+
+    if (!out || !syncPath(temp, O_WRONLY) || std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+
+    //the rename itself is only durable once the directory is synced
+    size_t slash = path.rfind('/');
+    string dir = (slash == string::npos) ? "." : (slash == 0) ? "/" : path.substr(0, slash);
+    return syncPath(dir, O_RDONLY | O_DIRECTORY);
+}
+
+//fsync a file or directory by path
+bool UTree::syncPath(const string& path, int flags) {
+    int fd = open(path.c_str(), flags);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+/**
+ * Replaces the tree with the contents of a file written by save(). The
+ * usernames come sorted, so the AVL tree is built balanced from the middle
+ * out and each DTree in a single bulk load, with no rotations or rebalancing.
+ * @param path path of the snapshot file
+ * @return true if the file was loaded, false if it's missing or invalid, leaving the tree alone
+ */
+bool UTree::load(const string& path) {
+    UTreeImage image;
+    if (!image.open(path))
+        return false;
+
+    //every badge and status is interned once, not once per account; each
+    //account takes its own reference and these are dropped once it's built
+    std::vector<uint32_t> ids(image._header->_numStrings);
+    for (unsigned int i = 0; i < ids.size(); i++)
+        ids[i] = StringDict::global().intern(string(image.text(image._strings[i])));
+
+    //cleared and rebuilt in one go, so no other write lands in between
+    WriteLock tree = writeLock(_lock);
+    clearLocked();
+    storeLink(_root, build(image, ids, 0, (int)image._header->_numUsernames - 1));
+    if (_lockFree)
+        publishAll(_root);
+    for (uint32_t id : ids)
+        StringDict::global().release(id);
+    return true;
+}
+
+/**
+ * Applies the writes in a WriteLog file, in order, on top of what the tree
+ * holds, usually a snapshot just load()ed. The tree lock is taken once and
+ * the records go through the internal insert and remove paths, with each
+ * username's run of inserts up to its next removal bulk loaded in one go.
+ * Nothing is logged again. Replay stops at the first torn or corrupt record.
+ * @param path path to the log file
+ * @return number of records replayed, -1 if the file could not be read
+ */
+int UTree::replay(const string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        return -1;
+    string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    WriteLock tree = writeLock(_lock);
+    std::unordered_map<string, std::vector<Account>> pending;
+    const char* pos = data.data();
+    LogRecord record;
+    DNode* removed;
+    int count = 0;
+    while (WriteLog::decode(pos, data.data() + data.size(), record)) {
+        string username(record._username);
+        if (record._op == LOG_INSERT) {
+            pending[username].emplace_back(username, record._disc, record._nitro, string(record._badge), string(record._status));
+        }
+        else {
+            //the username's earlier inserts have to be in before it can lose one
+            auto found = pending.find(username);
+            if (found != pending.end()) {
+                insertGroup(found->second);
+                pending.erase(found);
+            }
+            removeLocked(username, record._disc, removed);
+        }
+        count++;
+    }
+
+    for (auto& group : pending)
+        insertGroup(group.second);
+    return count;
+}
+
+/**
+ * Logs every later insert and removal that goes through, including those
+ * made by loadData() (with any number of threads), loadMapped() and
+ * insertBatch(). load() and clear() are not logged; checkpoint() after them,
+ * which saves a snapshot and empties the log with no write in between. The
+ * log has to outlive the tree or be detached first.
+ * @param log open log to append to, nullptr to stop logging
+ */
+void UTree::setLog(WriteLog* log) {
+    WriteLock tree = writeLock(_lock);
+    _log = log;
+}
+
+//a username's accounts in one go: the first the usual way, which creates the
+//UNode if it's new, the rest in a single bulk load
+void UTree::insertGroup(std::vector<Account>& group) {
+    insertUNode(Account(group[0]));
+    UNode* node = find(group[0].getUsername());
+    if (group.size() > 1)
+        node->getDTree()->bulkLoad(std::move(group));
+    if (_lockFree)
+        publish(node);
+}
+
+//create the UNodes a batch's runs are missing and relink the whole tree
+//balanced around them, in one pass over the merged username order
+void UTree::mergeUNodes(const std::vector<Account>& accounts, std::vector<std::pair<size_t, UNode*>>& runs) {
+    std::vector<UNode*> existing;
+    flatten(_root, existing);
+
+    std::vector<UNode*> nodes;
+    nodes.reserve(existing.size() + runs.size());
+    size_t i = 0;
+    for (size_t r = 0; r + 1 < runs.size(); r++) {
+        const string& username = accounts[runs[r].first]._username;
+        while (i < existing.size() && existing[i]->_username < username)
+            nodes.push_back(existing[i++]);
+        if (!runs[r].second)
+            runs[r].second = newUNode(username);
+        if (i < existing.size() && existing[i] == runs[r].second)
+            i++;
+        nodes.push_back(runs[r].second);
+    }
+    while (i < existing.size())
+        nodes.push_back(existing[i++]);
+
+    storeLink(_root, relink(nodes, 0, (int)nodes.size() - 1));
+}
+
+//every UNode, in username order
+void UTree::flatten(UNode* node, std::vector<UNode*>& nodes) const {
+    if (!node)
+        return;
+    flatten(node->_left, nodes);
+    nodes.push_back(node);
+    flatten(node->_right, nodes);
+}
+
+//balanced subtree of nodes lo to hi, already in username order
+UNode *UTree::relink(std::vector<UNode*>& nodes, int lo, int hi) {
+    if (lo > hi)
+        return nullptr;
+
+    int mid = lo + (hi - lo) / 2;
+    UNode* node = nodes[mid];
+    node->_left = relink(nodes, lo, mid - 1);
+    node->_right = relink(nodes, mid + 1, hi);
+    updateHeight(node);
+    return node;
+}
+
+//UNodes with accounts, in username order
+void UTree::collect(UNode* node, std::vector<UNode*>& nodes) const {
+    if (!node)
+        return;
+    collect(node->_left, nodes);
+    if (node->getDTree()->getNumUsers() > 0)
+        nodes.push_back(node);
+    collect(node->_right, nodes);
+}
+
+//balanced subtree of usernames lo to hi of a snapshot
+UNode *UTree::build(const UTreeImage& image, const std::vector<uint32_t>& ids, int lo, int hi) {
+    if (lo > hi)
+        return nullptr;
+
+    int mid = lo + (hi - lo) / 2;
+    const SnapshotUsername& user = image._usernames[mid];
+    UNode* node = newUNode(string(image.text(user._name)));
+
+    std::vector<Account> accounts;
+    accounts.reserve(user._count);
+    for (uint32_t i = user._first; i < user._first + user._count; i++) {
+        const SnapshotAccount& entry = image._accounts[i];
+        accounts.emplace_back(node->_username, entry._disc, entry._flags & NITRO_FLAG, DEFAULT_BADGE, DEFAULT_STATUS);
+        accounts.back()._badge = StringDict::global().acquire(ids[entry._badge]);
+        accounts.back()._status = StringDict::global().acquire(ids[entry._status]);
+    }
+    node->getDTree()->bulkLoad(std::move(accounts));
+
+    node->_left = build(image, ids, lo, mid - 1);
+    node->_right = build(image, ids, mid + 1, hi);
+    updateHeight(node);
+    return node;
+}
+
+//first ',' or newline in [pos, end), or end if there is none
+const char* UTree::scanDelim(const char* pos, const char* end) {
+#if defined(__AVX2__)
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for(; end - pos >= 32; pos += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)pos);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, comma), _mm256_cmpeq_epi8(chunk, newline)));
+        if(mask) return pos + __builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; end - pos >= 16; pos += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)pos);
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, newline)));
+        if(mask) return pos + __builtin_ctz(mask);
+    }
+#endif
+    //the last few bytes, or everything without SIMD
+    while(pos < end && *pos != ',' && *pos != '\n')
+        pos++;
+    return pos;
+}
+
+//whole field as a decimal int, nothing before or after it
+bool UTree::parseField(std::string_view field, int& value) {
+    const char* last = field.data() + field.size();
+    std::from_chars_result result = std::from_chars(field.data(), last, value);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+//the insertion proper, the caller holds the tree lock
+bool UTree::insertUNode(Account&& newAcct) {
+    UNode* existing = find(newAcct.getUsername());
+    //taken once for the whole descent, as find() does
+    uint64_t prefix = UNode::keyPrefix(newAcct.getUsername());
+
     if (!_root) {
       //inserting the root
-        _root = new UNode();
-        if (_root->getDTree()->insert(newAcct)){
+        storeLink(_root, newUNode(newAcct.getUsername()));
+        if (_root->getDTree()->insert(std::move(newAcct))){
 
             updateHeight(_root);
             if (checkImbalance(_root))
@@ -80,34 +751,48 @@ bool UTree::insert(Account newAcct) {
         return false;
     }
 
-    //if user already exists
-    else if (retrieveUser(newAcct.getUsername(), newAcct.getDiscriminator()))
+    //if user already exists, the occupancy bitmap answers without a DTree descent
+    else if (existing && existing->getDTree()->contains(newAcct.getDiscriminator()))
         return false;
 
     //insert user if doesn't exist
-    else if (insertHelper(newAcct.getUsername(), newAcct, _root)){
+    else if (insertHelper(std::move(newAcct), prefix, _root)){
         return true;
     }
     else
         return false;
 }
 
-bool UTree::insertHelper(string username, Account account, UNode *node) {
+/**
+ * Builds the account straight from its fields and moves it into its DNode.
+ * @param username username of the account
+ * @param disc discriminator of the account
+ * @param nitro whether the account has nitro
+ * @param badge badge of the account
+ * @param status status of the account
+ * @return true if the account was inserted, false otherwise
+ */
+bool UTree::emplace(string username, int disc, bool nitro, string badge, string status) {
+    return insert(Account(std::move(username), disc, nitro, std::move(badge), std::move(status)));
+}
+
+bool UTree::insertHelper(Account&& account, uint64_t prefix, UNode *node) {
     bool temp = false;
+    int cmp = node->compare(prefix, account.getUsername());
 
     //if username is the root node
-    if (node->getDTree()->getUsername() == account.getUsername()) {
-        node->getDTree()->insert(account);
+    if (cmp == 0) {
+        node->getDTree()->insert(std::move(account));
         updateHeight(node);
         if (checkImbalance(node))
             rebalance(node);
         return true;
     }
     //if username is greater than the root node
-    else if (account.getUsername() > node->getDTree()->getUsername()) {
+    else if (cmp > 0) {
         //go to the right
         if (node->_right) {
-            temp = insertHelper(username, account, node->_right);
+            temp = insertHelper(std::move(account), prefix, node->_right);
 
             updateHeight(node);
             if (checkImbalance(node))
@@ -115,8 +800,8 @@ bool UTree::insertHelper(string username, Account account, UNode *node) {
         }
 	//insert node
 	else {
-            node->_right = new UNode();
-            node->_right->getDTree()->insert(account);
+            storeLink(node->_right, newUNode(account.getUsername()));
+            node->_right->getDTree()->insert(std::move(account));
 
             updateHeight(node);
             if (checkImbalance(node))
@@ -128,7 +813,7 @@ bool UTree::insertHelper(string username, Account account, UNode *node) {
     else{
         //go to the left
         if (node->_left) {
-            temp = insertHelper(username, account, node->_left);
+            temp = insertHelper(std::move(account), prefix, node->_left);
 
             updateHeight(node);
             if (checkImbalance(node))
@@ -136,8 +821,8 @@ bool UTree::insertHelper(string username, Account account, UNode *node) {
         }
 	//insert node
 	else {
-            node->_left = new UNode();
-            node->_left->getDTree()->insert(account);
+            storeLink(node->_left, newUNode(account.getUsername()));
+            node->_left->getDTree()->insert(std::move(account));
 
             updateHeight(node);
             if (checkImbalance(node))
@@ -148,6 +833,28 @@ bool UTree::insertHelper(string username, Account account, UNode *node) {
         return temp;
 }
 
+//every UNode's DTree shares the tree's node pool and compaction policy
+UNode *UTree::newUNode(const string& username) {
+    UNode* node = _unodes.allocate(_dnodes);
+    node->setUsername(username);
+    node->getDTree()->setCompaction(_vacancyRatio, _inlineCompaction);
+    if (_hashIndex)
+        _index.insert(node);
+    return node;
+}
+
+//the username's UNode, the caller holds whatever lock it needs
+UNode *UTree::find(const string& username) const {
+    if (_hashIndex)
+        return _index.find(username);
+    return descend(username);
+}
+
+//plain descent by username
+UNode *UTree::descend(const string& username) const {
+    return _root ? _root->retrieve(username, _root) : nullptr;
+}
+
 /**
  * Removes a user with a matching username and discriminator.
  * @param username username to match
@@ -156,8 +863,44 @@ bool UTree::insertHelper(string username, Account account, UNode *node) {
  * @return true if an account was removed, false otherwise
  */
 bool UTree::removeUser(string username, int disc, DNode*& removed) {
+    string record = _log ? WriteLog::removeRecord(username, disc) : string();
+
+    //a removal that leaves accounts behind only needs the UNode locked
+    if (_concurrent && !_lockFree) {
+        ReadLock tree = readLock(_lock);
+        UNode* node = find(username);
+        if (!node)
+            return false;
+
+        WriteLock dtree = writeLock(node->_lock);
+        if (!node->getDTree()->contains(disc))
+            return false;
+        if (node->getDTree()->getNumUsers() > 1)
+            return logged(node->getDTree()->remove(disc, removed), record);
+    }
+
+    //the last account takes its UNode with it
+    WriteLock tree = writeLock(_lock);
+    return logged(removeLocked(username, disc, removed), record);
+}
+
+//the removal proper, the caller holds the tree lock
+bool UTree::removeLocked(const string& username, int disc, DNode*& removed) {
+    if (!_lockFree)
+        return removeHelper(username, disc, removed);
+
+    //unlinking a UNode moves usernames between nodes readers may be on, so
+    //an emptied one stays until lock-free reads are turned off
+    UNode* temp = find(username);
+    if (!temp || !temp->getDTree()->remove(disc, removed))
+        return false;
+    publish(temp);
+    return true;
+}
+
+bool UTree::removeHelper(const string& username, int disc, DNode*& removed) {
     bool remove = false;
-    UNode* temp = retrieve(username);
+    UNode* temp = find(username);
     if (temp) {
 
         //remove the node from the dtree
@@ -165,18 +908,67 @@ bool UTree::removeUser(string username, int disc, DNode*& removed) {
 	    remove = true;
       
 	//if the dtree is empty, remove it
-        if (temp->getDTree()->getNumUsers() <= 0) {
-            removeUNode(temp);
-        }
+        if (temp->getDTree()->getNumUsers() <= 0)
+            unlinkUNode(temp);
     }
     return remove;
 }
 
+//take a UNode out of the tree and rebalance what's above it
+void UTree::unlinkUNode(UNode* node) {
+    //the username that takes its place, the node physically
+    //unlinked is on the way down to it
+    string moved = node->_username;
+    std::vector<string> shifted;
+    if (node->_left) {
+        UNode* max = node->_left;
+        while (max->_right)
+            max = max->_right;
+        moved = max->_username;
+        shifted.push_back(moved);
+        if (max->_left)
+            shifted.push_back(max->_left->_username);
+    }
+    else if (node->_right) {
+        moved = node->_right->_username;
+        shifted.push_back(moved);
+    }
+
+    //usernames shift up a node or two on the way out, so their index
+    //entries are taken out first and put back where they land
+    if (_hashIndex) {
+        _index.erase(node->_username);
+        for (const string& username : shifted)
+            _index.erase(username);
+    }
+    removeUNode(node);
+    if (_hashIndex) {
+        for (const string& username : shifted)
+            _index.insert(descend(username));
+    }
+    retrace(_root, moved);
+}
+
+//fix heights and balance bottom up along the search path for username; at
+//username itself the path carries on through its left subtree's largest node
+void UTree::retrace(UNode*& node, const string& username) {
+    if (!node)
+        return;
+
+    retrace(username <= node->_username ? node->_left : node->_right, username);
+
+    //the rotations relink the parent themselves, so don't hand them the link
+    UNode* temp = node;
+    updateHeight(temp);
+    if (checkImbalance(temp))
+        rebalance(temp);
+}
+
 void UTree::removeUNode(UNode*& node) {
     if (node) {
       //delete root
       if (node == _root && !node->_left && !node->_right){
-	delete node;
+	_unodes.release(node);
 	node = nullptr;
 	_root = nullptr;
 	return;
@@ -190,10 +982,10 @@ void UTree::removeUNode(UNode*& node) {
 	//get the parent
 	while (parent->_left != node && parent->_right != node){
 
-	  if (parent->getUsername() > node->getUsername())
+	  if (node->precedes(parent))
 	    parent = parent->_left;
 
-	  else if (parent->getUsername() < node->getUsername())
+	  else if (parent->precedes(node))
 	    parent = parent->_right;
 	}
 	if (parent->_left == node)
@@ -216,8 +1008,9 @@ void UTree::removeUNode(UNode*& node) {
         }
 	//if there's a right, that node becomes the root
 	else if (node->_right) {
-	    *node->_dtree = *node->_right->_dtree;
-	    delete node->_right;
+	    *node->_dtree = std::move(*node->_right->_dtree);
+	    node->setUsername(std::move(node->_right->_username));
+	    _unodes.release(node->_right);
 	    node->_right = nullptr;
 
 	    updateHeight(node);
@@ -226,7 +1019,7 @@ void UTree::removeUNode(UNode*& node) {
 	}
 	//else the node is a leaf
 	else{
-            delete node;
+            _unodes.release(node);
 	    node = nullptr;
 	}
 	//reconnect parent to new root
@@ -252,9 +1045,9 @@ void UTree::removeUNodeLeft(UNode*& node, UNode* nodeX) {
 
   //find parent node
   while (parent->_left != nodeX && parent->_right != nodeX){
-    if (parent->getUsername() > nodeX->getUsername())
+    if (nodeX->precedes(parent))
       parent = parent->_left;
-    else if (parent->getUsername() < nodeX->getUsername())
+    else if (parent->precedes(nodeX))
       parent = parent->_right;
   }
   if (parent->_left == nodeX)
@@ -276,12 +1069,14 @@ void UTree::removeUNodeLeft(UNode*& node, UNode* nodeX) {
     return;
   }
 
-  *node->_dtree = *nodeX->_dtree;
+  *node->_dtree = std::move(*nodeX->_dtree);
+  node->setUsername(std::move(nodeX->_username));
 
   //nodeX has a left child, they switch places and the child is deleted
   if (nodeX->_left){
-    *nodeX->_dtree = *nodeX->_left->_dtree;
-    delete nodeX->_left;
+    *nodeX->_dtree = std::move(*nodeX->_left->_dtree);
+    nodeX->setUsername(std::move(nodeX->_left->_username));
+    _unodes.release(nodeX->_left);
     nodeX->_left = nullptr;
 
     updateHeight(nodeX);
@@ -291,7 +1086,7 @@ void UTree::removeUNodeLeft(UNode*& node, UNode* nodeX) {
   }
   //nodeX is a leaf, delete it
   else{
-    delete nodeX;
+    _unodes.release(nodeX);
     nodeX = nullptr;
   }
 
@@ -315,62 +1110,89 @@ void UTree::removeUNodeLeft(UNode*& node, UNode* nodeX) {
  * @param username username to match
  * @return UNode with a matching username, nullptr otherwise
  */
-UNode* UTree::retrieve(string username) {
-    if (_root) {
-      //username wanted is the root
-        if (_root->getUsername() == username)
-            return _root;
+UNode* UTree::retrieve(const string& username) {
+    if (_hashIndex && !_lockFree)
+        return _index.find(username);
 
-        else
-	  //get the username
-	  return (_root->retrieve(username, _root));
-    }
+    if (_root)
+        return _root->retrieve(username, _root);
     return nullptr;
 }
-UNode *UNode::retrieve(string username, UNode* node) {
-    UNode* temp;
 
-    //username matches the desired username
-    if (node->getDTree()->getUsername() == username)
-        return node;
-
-    //left node matches username
-    if (node->_left && node->_left->getUsername() == username) {
-      return node->_left;
+UNode *UNode::retrieve(const string& username, UNode* node) {
+    //the prefix settles most comparisons without touching the strings
+    uint64_t prefix = keyPrefix(username);
+    while (node) {
+        int cmp = node->compare(prefix, username);
+        if (cmp == 0)
+            return node;
+        node = (cmp < 0) ? node->_left : node->_right;
     }
+    return nullptr;
+}
 
-    //right node matches username
-    else if (node->_right && node->_right->getUsername() == username) {
-      return node->_right;
-    }
-
-    //username is on left side
-    else if (node->_left && username < node->getUsername())
-      temp = node->_left->retrieve(username, node->_left);
-
-    //username is on right side
-    else if (node->_right && username > node->getUsername())
-      temp = node->_right->retrieve(username, node->_right);
+/**
+ * Compares a username against this node's.
+ * @param prefix keyPrefix() of username
+ * @param username username to compare
+ * @return negative if username sorts first, 0 if they match, positive otherwise
+ */
+int UNode::compare(uint64_t prefix, const string& username) const {
+    if (prefix != _prefix)
+        return (prefix < _prefix) ? -1 : 1;
+    if (username.size() <= 8 && _username.size() <= 8)
+        return (int)username.size() - (int)_username.size();
+    return username.compare(_username);
+}
 
-    //username not in tree
-    else
-      temp = nullptr;
+/**
+ * Checks whether this node's username sorts before another node's.
+ * @param other node to compare with
+ * @return true if this node comes first
+ */
+bool UNode::precedes(const UNode* other) const {
+    return other->compare(_prefix, _username) < 0;
+}
 
-    return temp;
+/**
+ * The first 8 bytes of a username as a big-endian integer, zero padded, so
+ * integer order matches string order as far as those bytes go.
+ * @param username username to take the prefix of
+ * @return prefix of username
+ */
+uint64_t UNode::keyPrefix(const string& username) {
+    uint64_t prefix = 0;
+    memcpy(&prefix, username.data(), std::min<size_t>(username.size(), 8));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    prefix = __builtin_bswap64(prefix);
+#endif
+    return prefix;
 }
 
 /**
- * Retrieves the specified Account within a DNode.
+ * Retrieves the specified Account within a DNode. With lock-free reads on,
+ * this takes no lock, and the DNode is only safe to use while the caller
+ * holds an EpochGuard taken before the call; without one a writer may free
+ * it as soon as this returns. See the class comment for MAX_READERS.
  * @param username username to match
  * @param disc discriminator to match
  * @return DNode with a matching username and discriminator, nullptr otherwise
+ * @throws std::length_error if lock-free and more than MAX_READERS threads read at once
  */
-DNode* UTree::retrieveUser(string username, int disc) {
-    if (_root){
-      //desired username is the root, so search the root's dtree
-        if (_root->getUsername() == username)
-            return _root->getDTree()->retrieve(disc);
+DNode* UTree::retrieveUser(const string& username, int disc) {
+    if (_lockFree) {
+        EpochGuard guard;
+        UNode* temp = findPublished(username);
+        DTree* view = temp ? temp->_view.load(std::memory_order_acquire) : nullptr;
+        return view ? view->retrieve(disc) : nullptr;
+    }
 
+    if (_hashIndex) {
+        UNode* temp = _index.find(username);
+        return temp ? temp->getDTree()->retrieve(disc) : nullptr;
+    }
+
+    if (_root){
         UNode* temp = _root->retrieve(username, _root);
 
 	//if the username is in the tree, retreive the dnode from that dtree
@@ -382,34 +1204,441 @@ DNode* UTree::retrieveUser(string username, int disc) {
 }
 
 /**
- * Returns the number of users with a specific username.
+ * Retrieves a batch of accounts in one walk. The keys are sorted, then split
+ * around each UNode on the way down, so a UNode on the path to several keys
+ * is visited once and each username's discriminators share one DTree
+ * descent. With lock-free reads on, this takes no lock, and the DNodes are
+ * only safe to use while the caller holds an EpochGuard taken before the
+ * call, as with retrieveUser().
+ * @param keys username and discriminator of each account, in any order
+ * @param results set to the matching DNode of each key, or nullptr, in the same order
+ * @return number of DNodes found
+ * @throws std::length_error if lock-free and more than MAX_READERS threads read at once
+ */
+int UTree::retrieveUsers(const std::vector<std::pair<string, int>>& keys, std::vector<DNode*>& results) {
+    std::vector<int> order(keys.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&keys](int a, int b) {return keys[a] < keys[b];});
+    results.assign(keys.size(), nullptr);
+
+    if (_lockFree) {
+        EpochGuard guard;
+        return retrieveUsers(loadLink(_root), keys, order, 0, order.size(), results);
+    }
+    return retrieveUsers(_root, keys, order, 0, order.size(), results);
+}
+
+//retrieve the sorted keys order[lo, hi) from node's subtree
+int UTree::retrieveUsers(UNode* node, const std::vector<std::pair<string, int>>& keys, const std::vector<int>& order,
+                         int lo, int hi, std::vector<DNode*>& results) const {
+    int numFound = 0;
+    std::vector<int> discs;
+    std::vector<DNode*> found;
+    while (node && lo < hi) {
+        const string& username = node->_username;
+        int mid = std::lower_bound(order.begin() + lo, order.begin() + hi, username, [&keys](int i, const string& name) {
+            return keys[i].first < name;
+        }) - order.begin();
+        int end = mid;
+        while (end < hi && keys[order[end]].first == username)
+            end++;
+
+        //this username's discs, already in order
+        DTree* dtree = _lockFree ? node->_view.load(std::memory_order_acquire) : node->getDTree();
+        if (end > mid && dtree) {
+            discs.clear();
+            for (int i = mid; i < end; i++)
+                discs.push_back(keys[order[i]].second);
+            found.resize(discs.size());
+            numFound += dtree->retrieve(discs.data(), discs.size(), found.data());
+            for (int i = mid; i < end; i++)
+                results[order[i]] = found[i - mid];
+        }
+
+        numFound += retrieveUsers(loadLink(node->_left), keys, order, lo, mid, results);
+        lo = end;
+        node = loadLink(node->_right);
+    }
+    return numFound;
+}
+
+/**
+ * Copies out an account, safe to call while other threads write.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @param found set to the account if it exists
+ * @return true if a valid account with the username and discriminator exists
+ */
+bool UTree::findUser(const string& username, int disc, Account& found) const {
+    ReadLock tree = readLock(_lock);
+    UNode* temp = find(username);
+    if (!temp)
+        return false;
+
+    ReadLock dtree = readLock(temp->_lock);
+    DNode* node = temp->getDTree()->retrieve(disc);
+    if (!node)
+        return false;
+    found = node->getAccount();
+    return true;
+}
+
+/**
+ * Checks whether an account exists without touching its DNode.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @return true if a valid account with the username and discriminator exists
+ */
+bool UTree::contains(const string& username, int disc) const {
+    ReadLock tree = readLock(_lock);
+    UNode* temp = find(username);
+    if (!temp)
+        return false;
+
+    ReadLock dtree = readLock(temp->_lock);
+    return temp->getDTree()->contains(disc);
+}
+
+/**
+ * Checks a batch of discriminators of one username in a single lookup.
+ * @param username username to match
+ * @param discs discriminators to check
+ * @param n number of discriminators
+ * @param found set to whether each account exists, in the same order
+ * @return number of accounts found
+ */
+int UTree::contains(const string& username, const int discs[], int n, bool found[]) const {
+    ReadLock tree = readLock(_lock);
+    UNode* temp = find(username);
+    if (temp) {
+        ReadLock dtree = readLock(temp->_lock);
+        if (temp->getDTree()->getOccupancy())
+            return temp->getDTree()->getOccupancy()->contains(discs, n, found);
+    }
+
+    for (int i = 0; i < n; i++)
+        found[i] = false;
+    return 0;
+}
+
+/**
+ * Returns the number of users with a specific username. Takes no lock with
+ * lock-free reads on.
  * @param username username to match
  * @return number of users with the specified username
+ * @throws std::length_error if lock-free and more than MAX_READERS threads read at once
  */
-int UTree::numUsers(string username) {
-    UNode* temp = retrieve(username);
+int UTree::numUsers(const string& username) const {
+    if (_lockFree) {
+        EpochGuard guard;
+        UNode* temp = findPublished(username);
+        DTree* view = temp ? temp->_view.load(std::memory_order_acquire) : nullptr;
+        return view ? view->getNumUsers() : 0;
+    }
+
+    ReadLock tree = readLock(_lock);
+    UNode* temp = find(username);
     if (temp){
+        ReadLock dtree = readLock(temp->_lock);
         return temp->getDTree()->getNumUsers();
     }
     return 0;
 }
 
+/**
+ * Finds the discriminator a new account with this username should get.
+ * @param username username to match
+ * @return lowest discriminator not in use for the username, INVALID_DISC if all are taken
+ */
+int UTree::lowestFreeDisc(const string& username) const {
+    ReadLock tree = readLock(_lock);
+    UNode* temp = find(username);
+    if (temp){
+        ReadLock dtree = readLock(temp->_lock);
+        return temp->getDTree()->lowestFreeDisc();
+    }
+    return MIN_DISC;
+}
+
+/**
+ * Takes an O(1) point-in-time copy of one username's accounts, for reporting
+ * while the tree keeps taking writes. See DTree::snapshot().
+ * @param username username to match
+ * @return snapshot of the username's DTree, empty if the username is missing
+ */
+DTree UTree::snapshot(const string& username) {
+    ReadLock tree = readLock(_lock);
+    UNode* temp = find(username);
+    if (temp){
+        WriteLock dtree = writeLock(temp->_lock);
+        return temp->getDTree()->snapshot();
+    }
+    return DTree();
+}
+
 /**
  * Helper for the destructor to clear dynamic memory.
+ * Every DNode goes back in one sweep of the shared pool, so the DTrees
+ * destroyed with their UNodes afterwards have nothing left to walk. While
+ * snapshots still hold the pool, the DTrees release their own nodes instead
+ * and the snapshots keep the old pool alive.
  */
 void UTree::clear() {
-    if (_root) {
-        _root->clear(_root);
+    WriteLock tree = writeLock(_lock);
+    clearLocked();
+}
+
+//clear() proper, the caller holds the tree lock
+void UTree::clearLocked() {
+    if (_lockFree) {
+        //unlink everything and wait out the readers before any of it goes
+        UNode* root = _root;
+        storeLink(_root, nullptr);
+        EpochDomain::global().synchronize();
+        dropViews(root);
+        reclaim(true);
+    }
+    if (_dnodes.use_count() == 1 + (long)_unodes.getNumLive()) {
+        _dnodes->clear();
+        _unodes.clear();
     }
+    else {
+        _unodes.clear();
+        _dnodes = std::make_shared<DNodePool>();
+        _dnodes->setLocking(_concurrent);
+    }
+    _root = nullptr;
+    _index.clear();
 }
-void UNode::clear(UNode *node) {
+
+/**
+ * Turns thread safety on or off. Only call while no other thread is using
+ * the tree.
+ * @param concurrent true to lock for concurrent use, false for single-threaded use
+ */
+void UTree::setConcurrent(bool concurrent) {
+    _concurrent = concurrent;
+    _dnodes->setLocking(concurrent);
+}
+
+/**
+ * Turns lock-free reads on or off, see the class comment. Turning them on
+ * also turns on concurrent mode; turning them off drops the UNodes left
+ * empty meanwhile. Only call while no other thread is using the tree.
+ * @param lockFree true for retrieveUser() and numUsers() to take no lock
+ */
+void UTree::setLockFreeReads(bool lockFree) {
+    if (lockFree == _lockFree)
+        return;
+
+    _lockFree = lockFree;
+    if (lockFree) {
+        setConcurrent(true);
+        publishAll(_root);
+    }
+    else {
+        dropViews(_root);
+        reclaim(true);
+
+        std::vector<string> empty;
+        findEmpty(_root, empty);
+        for (const string& username : empty)
+            unlinkUNode(find(username));
+    }
+}
+
+/**
+ * Turns the username hash index on or off. With it on, point lookups by
+ * username go to an open-addressing hash table instead of descending the
+ * AVL tree, which is kept as is for ordered walks. Lock-free reads still
+ * descend the published tree. Takes the tree lock while the index is built.
+ * @param hashIndex true to build and maintain the index, false to drop it
+ */
+void UTree::setHashIndex(bool hashIndex) {
+    WriteLock tree = writeLock(_lock);
+    _hashIndex = hashIndex;
+    _index.clear();
+    if (hashIndex) {
+        std::vector<UNode*> nodes;
+        flatten(_root, nodes);
+        for (UNode* node : nodes)
+            _index.insert(node);
+    }
+}
+
+//lock-free descent by username, the caller is pinned
+UNode *UTree::findPublished(const string& username) const {
+    uint64_t prefix = UNode::keyPrefix(username);
+    UNode* node = loadLink(_root);
+    int cmp;
+    while (node && (cmp = node->compare(prefix, username)) != 0)
+        node = loadLink(cmp < 0 ? node->_left : node->_right);
+    return node;
+}
+
+//hand readers a fresh view of node's DTree, the old one goes once they're done with it
+void UTree::publish(UNode* node) {
+    DTree* view = new DTree(node->getDTree()->snapshot());
+    DTree* old = node->_view.exchange(view);
+    if (old)
+        _retiredViews.emplace_back(EpochDomain::global().retire(), old);
+
+    if (_retiredViews.size() + _retiredUNodes.size() >= RETIRE_BATCH)
+        reclaim(false);
+}
+
+//publish a view of every DTree
+void UTree::publishAll(UNode* node) {
+    if (!node)
+        return;
+    publishAll(node->_left);
+    publishAll(node->_right);
+    publish(node);
+}
+
+//delete every view, no reader may be left
+void UTree::dropViews(UNode* node) {
+    if (!node)
+        return;
+    dropViews(node->_left);
+    dropViews(node->_right);
+    delete node->_view.exchange(nullptr);
+}
+
+//usernames whose UNode has no accounts left, in order
+void UTree::findEmpty(UNode* node, std::vector<string>& usernames) const {
     if (!node)
         return;
-    clear(node->_left);
-    clear(node->_right);
+    findEmpty(node->_left, usernames);
+    if (node->getDTree()->getNumUsers() == 0)
+        usernames.push_back(node->_username);
+    findEmpty(node->_right, usernames);
+}
+
+//private copy of a node about to be relinked, the original is left as it was
+UNode *UTree::cloneUNode(UNode* node) {
+    UNode* copy = _unodes.allocate(node->_dtree);
+    copy->_username = node->_username;
+    copy->_prefix = node->_prefix;
+    copy->_view = node->_view.load();
+    copy->_height = node->_height;
+    copy->_left = node->_left;
+    copy->_right = node->_right;
+    if (_hashIndex)
+        _index.insert(copy);
+    return copy;
+}
+
+//the rotation rebalance() would do, carried out on copies of the nodes it
+//relinks and published with a single store in the parent, so readers on the
+//originals still see the tree as it was
+void UTree::rebalanceCopy(UNode* node) {
+    UNode* retired[3] = {node, nullptr, nullptr};
+    int left = node->_left ? node->_left->_height : -1;
+    int right = node->_right ? node->_right->_height : -1;
+    UNode* z = cloneUNode(node);
+    UNode* top;
+
+    if (left > right) {
+        UNode* y = node->_left;
+        int leftLeft = y->_left ? y->_left->_height : -1;
+        int leftRight = y->_right ? y->_right->_height : -1;
+        retired[1] = y;
+
+        if (leftLeft >= leftRight) {
+            //right rotation
+            top = cloneUNode(y);
+            z->_left = y->_right;
+            top->_right = z;
+        }
+        else {
+            //left-right rotation, y's right child comes up
+            UNode* x = y->_right;
+            UNode* y2 = cloneUNode(y);
+            retired[2] = x;
+            top = cloneUNode(x);
+            y2->_right = x->_left;
+            z->_left = x->_right;
+            top->_left = y2;
+            top->_right = z;
+            updateHeight(y2);
+        }
+    }
+    else {
+        UNode* y = node->_right;
+        int rightLeft = y->_left ? y->_left->_height : -1;
+        int rightRight = y->_right ? y->_right->_height : -1;
+        retired[1] = y;
+
+        if (rightLeft <= rightRight) {
+            //left rotation
+            top = cloneUNode(y);
+            z->_right = y->_left;
+            top->_left = z;
+        }
+        else {
+            //right-left rotation, y's left child comes up
+            UNode* x = y->_left;
+            UNode* y2 = cloneUNode(y);
+            retired[2] = x;
+            top = cloneUNode(x);
+            y2->_left = x->_right;
+            z->_right = x->_left;
+            top->_left = z;
+            top->_right = y2;
+            updateHeight(y2);
+        }
+    }
+    updateHeight(z);
+    updateHeight(top);
 
-    delete node;
-    node = nullptr;
+    //publish the rotated copies where node was
+    if (node == _root) {
+        storeLink(_root, top);
+    }
+    else {
+        UNode* parent = _root;
+        while (parent->_left != node && parent->_right != node)
+            parent = node->precedes(parent) ? parent->_left : parent->_right;
+        storeLink(parent->_left == node ? parent->_left : parent->_right, top);
+    }
+
+    unsigned long epoch = EpochDomain::global().retire();
+    for (UNode* old : retired) {
+        if (old)
+            _retiredUNodes.emplace_back(epoch, old);
+    }
+}
+
+//free what was retired before every pinned reader started, or everything
+//when no reader is left
+void UTree::reclaim(bool all) {
+    unsigned long safe = all ? ~0UL : EpochDomain::global().safeEpoch();
+
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < _retiredViews.size(); i++) {
+        if (_retiredViews[i].first < safe)
+            delete _retiredViews[i].second;
+        else
+            _retiredViews[kept++] = _retiredViews[i];
+    }
+    _retiredViews.resize(kept);
+
+    //the DTree and view of a replaced UNode live on in its copy
+    kept = 0;
+    for (unsigned int i = 0; i < _retiredUNodes.size(); i++) {
+        UNode* node = _retiredUNodes[i].second;
+        if (_retiredUNodes[i].first < safe) {
+            node->_dtree = nullptr;
+            node->_view = nullptr;
+            _unodes.release(node);
+        }
+        else {
+            _retiredUNodes[kept++] = _retiredUNodes[i];
+        }
+    }
+    _retiredUNodes.resize(kept);
 }
 
 /**
@@ -445,6 +1674,52 @@ void UTree::dump(UNode* node) const {
     cout << ")";
 }
 
+/**
+ * Maintenance pass that compacts the DTrees holding too many vacant nodes.
+ * @param force true to compact every DTree with a vacant node, regardless of policy
+ * @return bytes of node memory reclaimed
+ */
+size_t UTree::compact(bool force) {
+    WriteLock tree = writeLock(_lock);
+    if (!_root)
+        return 0;
+
+    size_t reclaimed = _root->compact(_root, force);
+    if (_lockFree && reclaimed > 0)
+        publishAll(_root);
+    return reclaimed;
+}
+size_t UNode::compact(UNode* node, bool force) {
+    if (!node)
+        return 0;
+
+    size_t reclaimed = compact(node->_left, force) + compact(node->_right, force);
+    if (force || node->getDTree()->needsCompaction())
+        reclaimed += node->getDTree()->compact();
+    return reclaimed;
+}
+
+/**
+ * Sets the compaction policy of every DTree, current and future.
+ * @param vacancyRatio share of vacant nodes, from 0 to 1, that calls for compaction
+ * @param inlineCompaction true to compact from remove, false to leave it to compact()
+ */
+void UTree::setCompaction(double vacancyRatio, bool inlineCompaction) {
+    WriteLock tree = writeLock(_lock);
+    _vacancyRatio = vacancyRatio;
+    _inlineCompaction = inlineCompaction;
+    if (_root)
+        _root->setCompaction(_root, vacancyRatio, inlineCompaction);
+}
+void UNode::setCompaction(UNode* node, double vacancyRatio, bool inlineCompaction) {
+    if (!node)
+        return;
+
+    setCompaction(node->_left, vacancyRatio, inlineCompaction);
+    setCompaction(node->_right, vacancyRatio, inlineCompaction);
+    node->getDTree()->setCompaction(vacancyRatio, inlineCompaction);
+}
+
 /**
  * Updates the height of the specified node.
  * @param node UNode object in which the height will be updated
@@ -510,6 +1785,11 @@ int UTree::checkImbalance(UNode* node) {
  * @param node UNode object where an imbalance occurred
  */
 void UTree::rebalance(UNode*& node) {
+    if (_lockFree) {
+        rebalanceCopy(node);
+        return;
+    }
+
   //start at -1 bec the height of a null child
     int right = -1; 
     int left = -1;
@@ -539,7 +1819,8 @@ void UTree::rebalance(UNode*& node) {
 
     //left heavy
     if ((left - right) > 1){
-        if (leftLeft > leftRight)
+        //even grandchildren only come up after a removal, one rotation fixes those
+        if (leftLeft >= leftRight)
              rightRotation(node);
         else {
             //double rotation
@@ -570,10 +1851,10 @@ UNode *UTree::rightRotation(UNode*& Z) {
     //find parent node
     while (parent->_left != Z && parent->_right != Z){
 
-      if (parent->getUsername() > Z->getUsername())
+      if (Z->precedes(parent))
 	parent = parent->_left;
 
-      else if (parent->getUsername() < Z->getUsername())
+      else if (parent->precedes(Z))
 	parent = parent->_right;
     }
 
@@ -598,9 +1879,9 @@ UNode *UTree::rightRotation(UNode*& Z) {
   else
     parent->_right = Y;
 
-  // Update heights
-  updateHeight(Y);
+  // Update heights, Z is below Y now
   updateHeight(Z);
+  updateHeight(Y);
   updateHeight(parent);
 
   // Return new root
@@ -620,10 +1901,10 @@ UNode *UTree::leftRotation(UNode *&Z) {
 
     while (parent->_left != Z && parent->_right != Z){
 
-      if (parent->getUsername() > Z->getUsername())
+      if (Z->precedes(parent))
 	parent = parent->_left;
 
-      else if (parent->getUsername() < Z->getUsername())
+      else if (parent->precedes(Z))
 	parent = parent->_right;
     }
 
@@ -670,10 +1951,10 @@ UNode *UTree::leftRightRotation(UNode *&Z) {
     //find parent node
     while (parent->_left != Z && parent->_right != Z){
 
-      if (parent->getUsername() > Z->getUsername())
+      if (Z->precedes(parent))
 	parent = parent->_left;
 
-      else if (parent->getUsername() < Z->getUsername())
+      else if (parent->precedes(Z))
 	parent = parent->_right;
     }
 
@@ -723,10 +2004,10 @@ UNode *UTree::rightLeftRotation(UNode *&Z) {
     //find parent node
     while (parent->_left != Z && parent->_right != Z){
 
-      if (parent->getUsername() > Z->getUsername())
+      if (Z->precedes(parent))
 	parent = parent->_left;
 
-      else if (parent->getUsername() < Z->getUsername())
+      else if (parent->precedes(Z))
 	parent = parent->_right;
     }
 
@@ -8,13 +8,21 @@
 #pragma once
 
 #include "dtree.h"
+#include "epoch.h"
+#include "uindex.h"
 #include <fstream>
+#include <cstring>
 #include <sstream>
+#include <shared_mutex>
+#include <string_view>
 
 #define DEFAULT_HEIGHT 0
+#define BATCH_REBUILD_RATIO 4   /* insertBatch() rebuilds the AVL links once it adds a quarter as many usernames as there are */
 
 class Grader;   /* For grading purposes */
 class Tester;   /* Forward declaration for testing class */
+class UTreeImage;
+class WriteLog;
 
 class UNode {
     friend class Grader;
@@ -23,6 +31,27 @@ class UNode {
 public:
     UNode() {
         _dtree = new DTree();
+        _view = nullptr;
+        _prefix = 0;
+        _height = DEFAULT_HEIGHT;
+        _left = nullptr;
+        _right = nullptr;
+    }
+
+    UNode(std::shared_ptr<DNodePool> pool) {
+        _dtree = new DTree(pool);
+        _view = nullptr;
+        _prefix = 0;
+        _height = DEFAULT_HEIGHT;
+        _left = nullptr;
+        _right = nullptr;
+    }
+
+    /* Takes over the DTree of a node being replaced */
+    UNode(DTree* dtree) {
+        _dtree = dtree;
+        _view = nullptr;
+        _prefix = 0;
         _height = DEFAULT_HEIGHT;
         _left = nullptr;
         _right = nullptr;
@@ -31,49 +60,124 @@ public:
     ~UNode() {
         delete _dtree;
         _dtree = nullptr;
+        delete _view.load();
     }
 
     /* Getters */
     DTree*& getDTree() {return _dtree;}
     int getHeight() const {return _height;}
-    string getUsername() const {return _dtree->getUsername();}
+    const string& getUsername() const {return _username;}
+
+    /* Keys */
+    void setUsername(string username) {_username = std::move(username); _prefix = keyPrefix(_username);}
+    int compare(uint64_t prefix, const string& username) const;
+    bool precedes(const UNode* other) const;
+    static uint64_t keyPrefix(const string& username);
 
 private:
     DTree* _dtree;
+    string _username;   /* key of the node, kept here so a descent never reads the DTree */
+    uint64_t _prefix;   /* first 8 bytes of _username, big-endian and zero padded */
+    mutable std::shared_mutex _lock;    /* guards _dtree in concurrent mode */
+    std::atomic<DTree*> _view;  /* snapshot of _dtree lock-free readers use, republished after each write */
     int _height;
     UNode* _left;
     UNode* _right;
 
     /* IMPLEMENT (optional): Additional helper functions */
-  UNode* retrieve(string username, UNode* node);
+  UNode* retrieve(const string& username, UNode* node);
 
     void print(UNode *node);
 
-    void clear(UNode* node);
+    size_t compact(UNode* node, bool force);
+
+    void setCompaction(UNode* node, double vacancyRatio, bool inlineCompaction);
+};
+
+/* A row loadMapped() skipped */
+struct LoadError {
+    int _line;          /* 1-based, 0 when the file itself couldn't be read */
+    string _reason;
+    string _row;
 };
 
+/* What loadMapped() made of a file */
+struct LoadReport {
+    int _numRows = 0;       /* lines read, good or bad */
+    int _numInserted = 0;   /* accounts inserted, duplicates aren't */
+    std::vector<LoadError> _errors;
+};
+
+/**
+ * In concurrent mode every public method below is safe to call from any
+ * thread, except retrieve(), retrieveUser(), retrieveUsers(), printUsers()
+ * and dump(), which hand out or walk internal nodes and need the tree to
+ * themselves. The AVL links are guarded by a tree lock and each DTree by its
+ * UNode's lock: queries hold both shared, writes to an existing username
+ * hold the tree lock shared and the UNode's exclusive, and anything that
+ * adds or removes a UNode (and so may rotate) holds the tree lock exclusive.
+ *
+ * With lock-free reads on, retrieveUser(), retrieveUsers() and numUsers()
+ * take no lock at all. Every write holds the tree lock exclusive and leaves whatever a
+ * reader may be on untouched: DTree writes go to a copy-on-write version
+ * that is then published as the UNode's view, rotations relink copies of
+ * the nodes involved, and a UNode whose last account goes stays in the tree
+ * empty until lock-free reads are turned off. Replaced nodes and views are
+ * freed through the EpochDomain once no reader can reach them.
+ *
+ * A DNode handed out by a lock-free retrieveUser() or retrieveUsers() is
+ * only safe to use while the calling thread holds an EpochGuard taken
+ * before the call: without one, a writer can retire and free it as soon as
+ * the call returns. Each thread that reads lock-free holds one of the
+ * EpochDomain's MAX_READERS slots until it exits; a read from one thread
+ * too many throws std::length_error before touching the tree.
+ */
 class UTree {
     friend class Grader;
     friend class Tester;
 
 public:
-    UTree():_root(nullptr){}
+    UTree():_root(nullptr), _dnodes(std::make_shared<DNodePool>()),
+            _vacancyRatio(DEFAULT_VACANCY_RATIO), _inlineCompaction(false), _concurrent(false), _lockFree(false), _log(nullptr), _hashIndex(false){}
 
     /* IMPLEMENT: destructor */
     ~UTree();
 
     /* IMPLEMENT: Basic operations */
 
-    void loadData(string infile, bool append = true);
-    bool insert(Account newAcct);
+    void loadData(string infile, bool append = true, int numThreads = 1);
+    bool loadMapped(const string& infile, LoadReport& report, bool append = true);
+    bool save(const string& path) const;
+    bool load(const string& path);
+    bool checkpoint(const string& path);
+    int replay(const string& path);
+    void setLog(WriteLog* log);
+    bool insert(const Account& newAcct) {return insert(Account(newAcct));}
+    bool insert(Account&& newAcct);
+    bool emplace(string username, int disc, bool nitro, string badge, string status);
+    int insertBatch(std::vector<Account> accounts);
     bool removeUser(string username, int disc, DNode*& removed);
-    UNode* retrieve(string username);
-    DNode* retrieveUser(string username, int disc);
-    int numUsers(string username);
+    UNode* retrieve(const string& username);
+    DNode* retrieveUser(const string& username, int disc);
+    int retrieveUsers(const std::vector<std::pair<string, int>>& keys, std::vector<DNode*>& results);
+    bool findUser(const string& username, int disc, Account& found) const;
+    bool contains(const string& username, int disc) const;
+    int contains(const string& username, const int discs[], int n, bool found[]) const;
+    int numUsers(const string& username) const;
+    int lowestFreeDisc(const string& username) const;
+    DTree snapshot(const string& username);
     void clear();
     void printUsers() const;
     void dump() const {dump(_root);}
     void dump(UNode* node) const;
+    size_t compact(bool force = false);
+    void setCompaction(double vacancyRatio, bool inlineCompaction);
+    void setConcurrent(bool concurrent);
+    bool isConcurrent() const {return _concurrent;}
+    void setLockFreeReads(bool lockFree);
+    bool hasLockFreeReads() const {return _lockFree;}
+    void setHashIndex(bool hashIndex);
+    bool hasHashIndex() const {return _hashIndex;}
 
 
     /* IMPLEMENT: "Helper" functions */
@@ -88,9 +192,98 @@ public:
 
 private:
     UNode* _root;
+    std::shared_ptr<DNodePool> _dnodes;     /* shared by the DTree of every UNode */
+    NodePool<UNode> _unodes;
+    double _vacancyRatio;       /* compaction policy handed to every DTree */
+    bool _inlineCompaction;
+    bool _concurrent;
+    mutable std::shared_mutex _lock;    /* guards the AVL structure in concurrent mode */
+    bool _lockFree;
+    std::vector<std::pair<unsigned long, UNode*>> _retiredUNodes;  /* replaced by copies, with their retire() stamps */
+    std::vector<std::pair<unsigned long, DTree*>> _retiredViews;
+    WriteLog* _log;             /* appended to by every insert and removal, if set */
+    bool _hashIndex;
+    UsernameIndex _index;       /* username to UNode, kept up to date while _hashIndex is set */
+
+    typedef std::shared_lock<std::shared_mutex> ReadLock;
+    typedef std::unique_lock<std::shared_mutex> WriteLock;
 
     /* IMPLEMENT (optional): any additional helper functions here! */
-    bool insertHelper(string username, Account account, UNode *node);
+    bool insertHelper(Account&& account, uint64_t prefix, UNode *node);
+
+    bool insertUNode(Account&& newAcct);
+
+    bool logged(bool applied, const string& record);
+
+    void insertGroup(std::vector<Account>& group);
+
+    void mergeUNodes(const std::vector<Account>& accounts, std::vector<std::pair<size_t, UNode*>>& runs);
+
+    void flatten(UNode* node, std::vector<UNode*>& nodes) const;
+
+    UNode *relink(std::vector<UNode*>& nodes, int lo, int hi);
+
+    void loadChunks(const string& data, int numThreads);
+
+    void logGroup(DTree* dtree, std::vector<Account>& group);
+
+    void collect(UNode* node, std::vector<UNode*>& nodes) const;
+
+    UNode *build(const UTreeImage& image, const std::vector<uint32_t>& ids, int lo, int hi);
+
+    static const char* scanDelim(const char* pos, const char* end);
+
+    static bool parseField(std::string_view field, int& value);
+
+    bool saveLocked(const string& path) const;
+
+    static bool syncPath(const string& path, int flags);
+
+    static void parseChunk(const string& data, size_t begin, size_t end, std::vector<std::vector<Account>>& parts);
+
+    UNode *newUNode(const string& username);
+
+    UNode *find(const string& username) const;
+
+    UNode *descend(const string& username) const;
+
+    int retrieveUsers(UNode* node, const std::vector<std::pair<string, int>>& keys, const std::vector<int>& order,
+                      int lo, int hi, std::vector<DNode*>& results) const;
+
+    bool removeLocked(const string& username, int disc, DNode*& removed);
+
+    void clearLocked();
+
+    bool removeHelper(const string& username, int disc, DNode*& removed);
+
+    void unlinkUNode(UNode* node);
+
+    void retrace(UNode*& node, const string& username);
+
+    /* Lock-free read mode */
+    UNode *findPublished(const string& username) const;
+
+    void publish(UNode* node);
+
+    void publishAll(UNode* node);
+
+    void dropViews(UNode* node);
+
+    void findEmpty(UNode* node, std::vector<string>& usernames) const;
+
+    UNode *cloneUNode(UNode* node);
+
+    void rebalanceCopy(UNode* node);
+
+    void reclaim(bool all);
+
+    /* Links lock-free readers follow are stored with release and loaded with acquire */
+    static UNode* loadLink(UNode* const& link) {return __atomic_load_n(&link, __ATOMIC_ACQUIRE);}
+    static void storeLink(UNode*& link, UNode* node) {__atomic_store_n(&link, node, __ATOMIC_RELEASE);}
+
+    /* Locks that are only taken in concurrent mode */
+    ReadLock readLock(std::shared_mutex& lock) const {return _concurrent ? ReadLock(lock) : ReadLock();}
+    WriteLock writeLock(std::shared_mutex& lock) const {return _concurrent ? WriteLock(lock) : WriteLock();}
 
     UNode *rightRotation(UNode *&node);
 
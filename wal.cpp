@@ -0,0 +1,314 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * WriteLog.cpp
+ * Implementation for the WriteLog class.
+ */
+
+#include "wal.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Destructor, syncs what is left and closes the file.
+ */
+WriteLog::~WriteLog() {
+    close();
+}
+
+/**
+ * Opens a log for appending, creating it if needed. Whatever follows the last
+ * whole record, like a record torn by a crash, is cut off first.
+ * @param path path to the log file
+ * @return true if the log is open, false otherwise
+ */
+bool WriteLog::open(const string& path) {
+    close();
+
+    std::ifstream in(path, std::ios::binary);
+    string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const char* pos = data.data();
+    LogRecord record;
+    while (decode(pos, data.data() + data.size(), record));
+    size_t valid = pos - data.data();
+
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (_fd < 0)
+        return false;
+    if (valid < data.size() && (ftruncate(_fd, valid) != 0 || fsync(_fd) != 0)) {
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+
+    _buffer.clear();
+    _numBuffered = 0;
+    _appended = _durable = _numSyncs = 0;
+    _stopping = _failed = _flushing = false;
+    _flusher = std::thread(&WriteLog::flushLoop, this);
+    return true;
+}
+
+/**
+ * Syncs every record appended so far, stops the flusher and closes the file.
+ */
+void WriteLog::close() {
+    if (_fd < 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stopping = true;
+    }
+    _wake.notify_one();
+    _flusher.join();
+    ::close(_fd);
+    _fd = -1;
+}
+
+/**
+ * Adds an encoded record to the log. It is on disk within LOG_FLUSH_MS, or
+ * once commit() returns.
+ * @param record record from insertRecord() or removeRecord()
+ * @return number of records appended since open(), this one included
+ */
+uint64_t WriteLog::append(const string& record) {
+    std::lock_guard<std::mutex> guard(_lock);
+    _buffer += record;
+    if (++_numBuffered == LOG_GROUP_SIZE)
+        _wake.notify_one();
+    return ++_appended;
+}
+
+/**
+ * Waits until every record appended so far, by any thread, is synced.
+ * @return true if they are durable, false if a write or sync failed
+ */
+bool WriteLog::commit() {
+    std::unique_lock<std::mutex> guard(_lock);
+    if (_fd < 0)
+        return false;
+
+    uint64_t target = _appended;
+    _numWaiting++;
+    _wake.notify_one();
+    _synced.wait(guard, [&]() {return _durable >= target || _failed;});
+    _numWaiting--;
+    return _durable >= target;
+}
+
+/**
+ * Empties the log, once a snapshot holds everything in it. Records appended
+ * but not yet written are dropped too. A flush already writing is waited
+ * out first, so nothing from before the truncate lands in the emptied file.
+ * Writes that go in after the snapshot and before this are lost; for a
+ * UTree's log use UTree::checkpoint(), which shuts them out.
+ * @return true if the log is empty on disk, false otherwise
+ */
+bool WriteLog::truncate() {
+    std::unique_lock<std::mutex> guard(_lock);
+    if (_fd < 0)
+        return false;
+    _synced.wait(guard, [&]() {return !_flushing;});
+
+    _buffer.clear();
+    _numBuffered = 0;
+    bool ok = ftruncate(_fd, 0) == 0 && fsync(_fd) == 0;
+
+    //whoever waits in commit() is covered, the snapshot holds their records
+    if (ok)
+        _durable = _appended;
+    _synced.notify_all();
+    return ok;
+}
+
+uint64_t WriteLog::getNumAppended() {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _appended;
+}
+
+uint64_t WriteLog::getNumDurable() {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _durable;
+}
+
+uint64_t WriteLog::getNumSyncs() {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _numSyncs;
+}
+
+/**
+ * Encodes the insertion of an account.
+ * @param account account being inserted
+ * @return record to append()
+ */
+string WriteLog::insertRecord(const Account& account) {
+    return encode(LOG_INSERT, account.getDiscriminator(), account.hasNitro(), account.getUsername(),
+                  account.getBadge(), account.getStatus());
+}
+
+/**
+ * Encodes the removal of an account.
+ * @param username username of the account
+ * @param disc discriminator of the account
+ * @return record to append()
+ */
+string WriteLog::removeRecord(const string& username, int disc) {
+    return encode(LOG_REMOVE, disc, false, username, DEFAULT_BADGE, DEFAULT_STATUS);
+}
+
+/**
+ * Decodes the record at pos, if there is a whole one with a matching checksum.
+ * @param pos start of the record, moved past it on success
+ * @param end end of the log data
+ * @param record set to the decoded record, its strings point into the data
+ * @return true if a record was decoded, false at the end of the data or a bad record
+ */
+bool WriteLog::decode(const char*& pos, const char* end, LogRecord& record) {
+    uint32_t length, sum;
+    if (end - pos < LOG_HEADER)
+        return false;
+    memcpy(&length, pos, 4);
+    memcpy(&sum, pos + 4, 4);
+    if ((uint64_t)(end - pos - LOG_HEADER) < length || length < 10 || checksum(pos + LOG_HEADER, length) != sum)
+        return false;
+
+    //op, disc, flags, then the string lengths
+    const char* payload = pos + LOG_HEADER;
+    int16_t disc;
+    uint16_t lengths[3];
+    memcpy(&disc, payload + 1, 2);
+    memcpy(lengths, payload + 4, 6);
+    if ((payload[0] != LOG_INSERT && payload[0] != LOG_REMOVE) || disc < MIN_DISC || disc > MAX_DISC ||
+        10u + lengths[0] + lengths[1] + lengths[2] != length)
+        return false;
+
+    record._op = (LogOp)payload[0];
+    record._disc = disc;
+    record._nitro = payload[3] & NITRO_FLAG;
+    record._username = std::string_view(payload + 10, lengths[0]);
+    record._badge = std::string_view(payload + 10 + lengths[0], lengths[1]);
+    record._status = std::string_view(payload + 10 + lengths[0] + lengths[1], lengths[2]);
+    pos += LOG_HEADER + length;
+    return true;
+}
+
+/**
+ * CRC32C of a buffer, with the SSE4.2 instruction when built with it.
+ * @param data bytes to sum
+ * @param size number of bytes
+ * @return checksum of the bytes
+ */
+uint32_t WriteLog::checksum(const char* data, size_t size) {
+    uint32_t crc = 0xffffffff;
+#if defined(__SSE4_2__)
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+    for (; size > 0; data++, size--)
+        crc = _mm_crc32_u8(crc, *data);
+#else
+    //a byte at a time, the Castagnoli polynomial reflected
+    static const struct Table {
+        uint32_t _entries[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t entry = i;
+                for (int bit = 0; bit < 8; bit++)
+                    entry = (entry >> 1) ^ (entry & 1 ? 0x82f63b78 : 0);
+                _entries[i] = entry;
+            }
+        }
+    } table;
+    for (; size > 0; data++, size--)
+        crc = table._entries[(crc ^ (uint8_t)*data) & 0xff] ^ (crc >> 8);
+#endif
+    return ~crc;
+}
+
+//write and sync what's buffered whenever a group fills, a commit() waits or
+//LOG_FLUSH_MS pass, until close()
+void WriteLog::flushLoop() {
+    std::unique_lock<std::mutex> guard(_lock);
+    while (!_stopping) {
+        _wake.wait_for(guard, std::chrono::milliseconds(LOG_FLUSH_MS), [&]() {
+            return _stopping || _numBuffered >= LOG_GROUP_SIZE || (_numWaiting > 0 && _numBuffered > 0);
+        });
+        flush(guard);
+    }
+    flush(guard);
+}
+
+//write the buffer out without holding the lock, so appends carry on meanwhile
+void WriteLog::flush(std::unique_lock<std::mutex>& guard) {
+    if (_numBuffered == 0 || _failed)
+        return;
+
+    string data;
+    data.swap(_buffer);
+    uint64_t target = _appended;
+    _numBuffered = 0;
+    _flushing = true;
+    guard.unlock();
+
+    const char* pos = data.data();
+    size_t left = data.size();
+    bool ok = true;
+    while (ok && left > 0) {
+        ssize_t written = ::write(_fd, pos, left);
+        ok = written > 0;
+        if (ok) {
+            pos += written;
+            left -= written;
+        }
+    }
+    ok = ok && fdatasync(_fd) == 0;
+
+    guard.lock();
+    _flushing = false;
+    if (ok) {
+        _durable = std::max(_durable, target);
+        _numSyncs++;
+    }
+    else {
+        _failed = true;
+    }
+    _synced.notify_all();
+}
+
+//the payload after the header: op, disc, flags, string lengths, strings
+string WriteLog::encode(LogOp op, int disc, bool nitro, const string& username, const string& badge, const string& status) {
+    if (username.size() > UINT16_MAX || badge.size() > UINT16_MAX || status.size() > UINT16_MAX)
+        throw std::length_error("Log records hold strings of up to " + std::to_string(UINT16_MAX) + " bytes");
+
+    uint32_t length = 10 + username.size() + badge.size() + status.size();
+    string record(LOG_HEADER + 10, '\0');
+    char* payload = &record[LOG_HEADER];
+    int16_t disc16 = disc;
+    uint16_t lengths[3] = {(uint16_t)username.size(), (uint16_t)badge.size(), (uint16_t)status.size()};
+    payload[0] = op;
+    memcpy(payload + 1, &disc16, 2);
+    payload[3] = nitro ? NITRO_FLAG : 0;
+    memcpy(payload + 4, lengths, 6);
+    record += username;
+    record += badge;
+    record += status;
+
+    uint32_t sum = checksum(record.data() + LOG_HEADER, length);
+    memcpy(&record[0], &length, 4);
+    memcpy(&record[4], &sum, 4);
+    return record;
+}
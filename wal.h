@@ -0,0 +1,94 @@
+/**
+ * CMSC 341 - Spring 2021
+ * Project 2 - Binary Trees
+ * WriteLog.h
+ * An append-only, checksummed log of UTree writes, synced in groups.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "dtree.h"
+
+#define LOG_HEADER 8            /* payload length and checksum before every record */
+#define LOG_GROUP_SIZE 256      /* buffered records that wake the flusher early */
+#define LOG_FLUSH_MS 10         /* longest a record waits to be synced */
+
+enum LogOp {LOG_INSERT = 1, LOG_REMOVE = 2};
+
+/* One decoded record, its strings point into the log data */
+struct LogRecord {
+    LogOp _op;
+    int _disc;
+    bool _nitro;
+    std::string_view _username;
+    std::string_view _badge;
+    std::string_view _status;
+};
+
+/**
+ * Records are appended to a buffer in memory and a flusher thread writes and
+ * fsyncs whatever has piled up, every LOG_FLUSH_MS or as soon as
+ * LOG_GROUP_SIZE records are waiting, so one fsync covers a whole group of
+ * writes. commit() waits until everything appended so far is on disk; any
+ * number of threads waiting at once share the same fsync.
+ *
+ * Each record is [payload length][CRC32C of payload][payload], the payload
+ * being op, disc, flags, the three string lengths and the strings. A crash
+ * can leave a torn record at the end, open() cuts the file back to the last
+ * whole one.
+ */
+class WriteLog {
+    friend class Tester;
+
+public:
+    WriteLog(): _fd(-1), _numBuffered(0), _appended(0), _durable(0), _numSyncs(0),
+                _numWaiting(0), _stopping(false), _failed(false), _flushing(false) {}
+    ~WriteLog();
+
+    WriteLog(const WriteLog&) = delete;
+    WriteLog& operator=(const WriteLog&) = delete;
+
+    bool open(const string& path);
+    void close();
+    uint64_t append(const string& record);
+    bool commit();
+    bool truncate();
+
+    /* Getters */
+    bool isOpen() const {return _fd >= 0;}
+    uint64_t getNumAppended();
+    uint64_t getNumDurable();
+    uint64_t getNumSyncs();
+
+    /* Encoding */
+    static string insertRecord(const Account& account);
+    static string removeRecord(const string& username, int disc);
+    static bool decode(const char*& pos, const char* end, LogRecord& record);
+    static uint32_t checksum(const char* data, size_t size);
+
+private:
+    int _fd;
+    std::thread _flusher;
+    std::mutex _lock;
+    std::condition_variable _wake;      /* the flusher waits on it */
+    std::condition_variable _synced;    /* commit() and truncate() wait on it */
+    string _buffer;                     /* records appended but not yet written */
+    int _numBuffered;
+    uint64_t _appended;                 /* records appended since open() */
+    uint64_t _durable;                  /* records written and synced */
+    uint64_t _numSyncs;
+    int _numWaiting;                    /* threads in commit() */
+    bool _stopping;
+    bool _failed;                       /* a write or sync failed, nothing is durable past _durable */
+    bool _flushing;                     /* the flusher is writing without the lock, truncate() waits it out */
+
+    void flushLoop();
+    void flush(std::unique_lock<std::mutex>& guard);
+    static string encode(LogOp op, int disc, bool nitro, const string& username, const string& badge, const string& status);
+};